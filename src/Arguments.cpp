@@ -65,6 +65,66 @@ Settings Arguments::parse( int argc, char** argv )
       else if ( ! strcmp(argv[i],"--binary-only") ) {
          s.binary_only = true;
       }
+      else if ( ! strcmp(argv[i],"--multi") ) {
+         s.multi_session = true;
+      }
+      else if ( ! strcmp(argv[i],"--splice") ) {
+         s.zero_copy = true;
+      }
+      else if ( ! strcmp(argv[i],"--engine") && i+1 <= last_arg_index ) {
+         ++i;
+         if ( ! strcmp(argv[i],"epoll") )
+            s.engine = Settings::EPOLL;
+         else if ( ! strcmp(argv[i],"uring") )
+            s.engine = Settings::URING;
+         else
+            ErrIf( true ).info("Bad engine: %s\n", argv[i]);
+      }
+      else if ( ! strcmp(argv[i],"--read-budget") && i+1 <= last_arg_index ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    s.read_budget=boost::lexical_cast<size_t>(argv[++i]))
+                  .info("Bad read budget\n");
+         ErrIf( s.read_budget == 0 ).info("Read budget must be more than 0\n");
+      }
+      else if ( ! strcmp(argv[i],"--queue-high") && i+1 <= last_arg_index ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    s.queue_high=boost::lexical_cast<size_t>(argv[++i]))
+                  .info("Bad queue high water mark\n");
+      }
+      else if ( ! strcmp(argv[i],"--queue-low") && i+1 <= last_arg_index ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    s.queue_low=boost::lexical_cast<size_t>(argv[++i]))
+                  .info("Bad queue low water mark\n");
+      }
+      else if ( ! strcmp(argv[i],"--rec-queue") && i+1 <= last_arg_index ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    s.rec_queue=boost::lexical_cast<size_t>(argv[++i]))
+                  .info("Bad recorder queue size\n");
+      }
+      else if ( ! strcmp(argv[i],"--rec-policy") && i+1 <= last_arg_index ) {
+         ++i;
+         if ( ! strcmp(argv[i],"block") )
+            s.rec_policy = Settings::BLOCK;
+         else if ( ! strcmp(argv[i],"drop-newest") )
+            s.rec_policy = Settings::DROP_NEWEST;
+         else if ( ! strcmp(argv[i],"drop-oldest") )
+            s.rec_policy = Settings::DROP_OLDEST;
+         else
+            ErrIf( true ).info("Bad recorder policy: %s\n", argv[i]);
+      }
+      else if ( ! strcmp(argv[i],"--metrics") && i+1 <= last_arg_index ) {
+         s.metrics_path.assign(argv[++i]);
+      }
+      else if ( ! strcmp(argv[i],"--segment-size") && i+1 <= last_arg_index ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    s.segment_bytes=boost::lexical_cast<uint64_t>(argv[++i]))
+                  .info("Bad segment size\n");
+      }
+      else if ( ! strcmp(argv[i],"--segment-time") && i+1 <= last_arg_index ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    s.segment_secs=boost::lexical_cast<unsigned>(argv[++i]))
+                  .info("Bad segment time\n");
+      }
       else if ( ! strcmp(argv[i],"-o") && i+1 <= last_arg_index ) {
          s.output_filename.assign(argv[++i]);
       }
@@ -108,10 +168,21 @@ Settings Arguments::parse( int argc, char** argv )
              << named_value( s.L_port )
              << "s.R_cmd = [";
    int n = 0;
-   while( s.R_cmd[n] != 0 ) {
+   while( s.R_cmd && s.R_cmd[n] != 0 ) {
       std::cout << s.R_cmd[n++] << ", ";
    } 
    std::cout << "]\n";
+   
+   ErrIf( s.zero_copy && s.engine == Settings::URING )
+        .info("--splice can't be used with --engine uring\n");
+
+   ErrIf( s.queue_high == 0 || s.queue_low > s.queue_high )
+        .info("The queue high water mark must be more than 0, and no less "
+              "than the low water mark\n");
+
+   ErrIf( s.R_cmd == 0 && ! s.multi_session )
+        .info("The -R option is required unless --multi is given\n%s",
+              usage_.c_str());
 
    return s;
 }
@@ -0,0 +1,141 @@
+#include "AsyncRecorder.hpp"
+#include "Buffer.hpp"
+#include "BufferPool.hpp"
+#include <cstring>
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace ntee {
+
+//! @brief Wraps a Recorder and starts its thread.
+//!
+//! @param target    The Recorder to run on the new thread.
+//! @param capacity  Number of records the ring can hold.
+//! @param policy    What record() does when the ring is full.
+AsyncRecorder::AsyncRecorder( const boost::shared_ptr<Recorder>& target,
+                              size_t capacity, Settings::RecPolicy policy )
+ : target_(target), policy_(policy), ring_(capacity),
+   dropped_(0), done_(false), sleeping_(false)
+{
+   thread_.reset( new boost::thread( boost::bind(&AsyncRecorder::drain, this) ) );
+}
+
+
+//! Makes sure the thread has been stopped.
+AsyncRecorder::~AsyncRecorder()
+{
+   shutdown();
+}
+
+
+//! @brief Publishes the message to the recorder thread.
+//!
+//! A reference counted Buffer is published as is; the recorder thread
+//! drops the reference once the wrapped Recorder is done with it.  Any
+//! other Buffer only lives for the duration of the call, so its payload,
+//! all segments of it, is copied into one from the BufferPool first.
+//!
+//! @param b   The message.
+void AsyncRecorder::record( const Buffer& b )
+{
+   BufferPtr ref;
+   if ( b.shared() ) {
+      ref = const_cast<Buffer*>( &b );
+   }
+   else {
+      ref = BufferPool::instance().acquire( b.size() );
+      char* p = ref->block();
+      for( const Buffer* seg = &b; seg; seg = seg->next.get() ) {
+         memcpy( p, seg->buf, seg->len );
+         p += seg->len;
+      }
+      ref->type = b.type;
+      ref->ts = b.ts;
+      ref->session = b.session;
+      ref->len = p - ref->block();
+   }
+   Buffer* copy = ref.detach();   // the ring owns this reference now
+
+   if ( ! ring_.push( copy ) ) {
+      switch( policy_ ) {
+      case Settings::DROP_NEWEST:
+         intrusive_ptr_release( copy );
+         ++dropped_;
+         break;
+      case Settings::DROP_OLDEST:
+         while( ! ring_.push( copy ) ) {
+            Buffer* old = ring_.evict();
+            if ( old ) {
+               intrusive_ptr_release( old );
+               ++dropped_;
+            }
+         }
+         break;
+      case Settings::BLOCK:
+      default:
+         while( ! ring_.push( copy ) ) {
+            wake();
+            boost::this_thread::yield();
+         }
+         break;
+      }
+   }
+   wake();
+}
+
+
+//! @brief Stops the thread and shuts the wrapped Recorder down.
+//!
+//! Everything already in the ring is recorded first.  Safe to call more
+//! than once.
+void AsyncRecorder::shutdown()
+{
+   if ( ! thread_ )
+      return;
+   done_ = true;
+   wake();
+   thread_->join();
+   thread_.reset();
+   target_->shutdown();
+
+   if ( dropped_ > 0 )
+      std::cerr << "Recorder dropped " << dropped_ << " records\n";
+}
+
+
+//! @brief Recorder thread main loop.
+//!
+//! Takes records off the ring and hands them to the wrapped Recorder.
+//! When the ring is empty the thread sleeps until woken by record(), the
+//! timed wait covers a wake up that slipped in before it fell asleep.
+void AsyncRecorder::drain()
+{
+   for( ;; ) {
+      Buffer* b;
+      while( (b=ring_.pop()) != 0 ) {
+         target_->record( *b );
+         intrusive_ptr_release( b );
+      }
+      if ( done_ && ring_.size() == 0 )
+         return;
+
+      boost::unique_lock<boost::mutex> lock( mutex_ );
+      sleeping_ = true;
+      if ( ring_.size() == 0 && ! done_ )
+         cond_.wait_for( lock, boost::chrono::milliseconds(10) );
+      sleeping_ = false;
+   }
+}
+
+
+//! Wakes the recorder thread, if it is asleep.
+void AsyncRecorder::wake()
+{
+   if ( sleeping_ ) {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      cond_.notify_one();
+   }
+}
+
+} // end namespace ntee
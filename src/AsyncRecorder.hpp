@@ -0,0 +1,59 @@
+#ifndef INCLUDED_ASYNCRECORDER_HPP
+#define INCLUDED_ASYNCRECORDER_HPP
+
+#include "NTee.hpp"
+#include "RecordRing.hpp"
+#include "Settings.hpp"
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace ntee {
+
+//! @brief Runs another Recorder on a thread of its own.
+//!
+//! record() is called on the relay thread.  It publishes a reference to
+//! the message's Buffer into a RecordRing, then returns right away.  A
+//! dedicated thread drains the ring into the wrapped Recorder, so a slow
+//! disk never holds up the traffic between L and R.  What happens when the
+//! ring is full is decided by the Settings::RecPolicy given.
+class AsyncRecorder : public Recorder {
+public:
+   AsyncRecorder( const boost::shared_ptr<Recorder>& target,
+                  size_t capacity, Settings::RecPolicy policy );
+   virtual ~AsyncRecorder();
+
+   virtual void record( const Buffer& );
+   virtual void shutdown();
+
+   //! @returns the number of records thrown away because the ring was full.
+   virtual uint64_t dropped() const { return dropped_.load(); }
+
+   //! @returns the number of records waiting on the recorder thread.
+   virtual size_t lag() const { return ring_.size(); }
+
+private:
+   AsyncRecorder( const AsyncRecorder& );
+   AsyncRecorder& operator=( const AsyncRecorder& );
+
+   void drain();
+   void wake();
+
+   boost::shared_ptr<Recorder> target_;    //!< where the records end up
+   Settings::RecPolicy policy_;            //!< what to do when full
+   RecordRing ring_;                       //!< relay to recorder hand off
+   boost::atomic<uint64_t> dropped_;       //!< records thrown away
+   boost::atomic<bool> done_;              //!< no more records coming
+   boost::atomic<bool> sleeping_;          //!< recorder thread is waiting
+   boost::mutex mutex_;                    //!< only guards the sleeping
+   boost::condition_variable cond_;        //!< wakes the recorder thread
+   boost::scoped_ptr<boost::thread> thread_;
+};
+
+} // end namespace ntee
+
+#endif
@@ -1,98 +1,488 @@
+
 #include "BinaryDataReader.hpp"
-#include "Buffer.hpp"
+#include "SegmentSet.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
 
 namespace ntee {
 
-//! @brief Private routine to read and make the next buffer.
-//! @returns a dynamically allocated Buffer filled with the next entry from the
-//!          data file being read, OR null if the file is empty.
-Buffer* BinaryDataReader::mkBuffer()
+const uint64_t BinaryDataReader::NOT_COUNTED;
+
+
+//! Makes a reader with no file open.
+BinaryDataReader::BinaryDataReader()
+ : seg_(0), at_(0), open_(false), truncated_(false), counted_(false)
+{
+   // empty
+}
+
+
+//! Unmaps the file.
+BinaryDataReader::~BinaryDataReader()
 {
+   close();
+}
+
+
+//! @brief Private routine to pick apart the record at a place in a
+//!        segment.
+//!
+//! @param seg  the segment.
+//! @param at   the record.
+//! @param v    set to the record.
+//! @returns the record after it, or NULL if there is no whole record at
+//!          at.
+const char* BinaryDataReader::parse( const Segment& seg, const char* at,
+                                     RecordView& v ) const
+{
+   size_t left = seg.base + seg.size - at;
+   if ( left < seg.headerLen )
+      return 0;
    char dest;
-   fd_.read( &dest, sizeof(char));
-   uint32_t llen;
-   fd_.read( reinterpret_cast<char*>(&llen), sizeof(uint32_t));
-   llen = ntohl(llen);
-   char* buf = (char*) malloc( llen );
-   llen = fd_.readsome( buf, llen );
-   
-   // If any of the reads got to EOF, then delete the malloc, and return null.
-   if ( fd_.eof() ) {
-      free( buf ); 
+   if ( seg.version == 0 ) {
+      uint32_t llen;
+      memcpy( &llen, at + sizeof(char), sizeof(uint32_t) );
+      dest = *at;
+      v.len = ntohl(llen);
+      v.time = v.seq = 0;
+      v.session = 0;
+   }
+   else {
+      RecordFormat::RecordHeader h;
+      h.get( at );
+      dest = h.dest;
+      v.len = h.len;
+      v.time = h.time;
+      v.seq = h.seq;
+      v.session = h.session;
+   }
+   if ( left - seg.headerLen < v.len )
       return 0;
+   v.type = (dest == 'L')?R_to_L
+                         :L_to_R;
+   v.data = at + seg.headerLen;
+   return v.data + v.len;
+}
+
+
+//! Views the record at at in segment seg, or the first one of a later
+//! segment if there is no whole record there, or becomes the end
+//! iterator.
+void BinaryDataReader::iterator::load( size_t seg, const char* at )
+{
+   const std::vector<Segment>& segs = reader_->segs_;
+   while( seg < segs.size() ) {
+      if ( at && (next_ = reader_->parse( segs[seg], at, view_ )) != 0 ) {
+         seg_ = seg;
+         at_ = at;
+         return;
+      }
+      if ( ++seg < segs.size() )
+         at = segs[seg].first;
    }
-   
-   // Not the EOF, so allocate a buffer and fill it up.
-   Buffer* pB = new Buffer();
-   pB->len = llen;
-   pB->buf = buf;
-   pB->type = (dest == 'L')?R_to_L
-                           :L_to_R;
-   return pB;
+   seg_ = segs.size();
+   at_ = next_ = 0;
 }
 
 
 //! @brief Opens the data file for reading.
 //!
-//! Opens a file for reading.  If the file does not exist, or can't be opened this
-//! routine will return -1.
+//! Opens and maps a file for reading, or every segment listed in it if it
+//! is a manifest.  The format of each file is worked out from its file
+//! header; a file without one is version 0.  If the file does not exist,
+//! can't be opened, or has a header for records shorter than this
+//! version's, this routine will return -1.
 //!
 //! @param s  path to a file name.
 //! @returns 0 when everything is okay, -1 if there were problems with
 //!          opening the file.
 int BinaryDataReader::open( const std::string& s )
 {
-   using namespace std;
-   fd_.open( s.c_str(), fstream::in|fstream::binary );
-   return (fd_.good())?0:-1;
+   close();
+   std::vector<std::string> paths;
+   if ( ! SegmentSet::read( s, paths ) )
+      paths.push_back( s );
+   for( size_t i=0; i < paths.size(); ++i ) {
+      if ( map( paths[i] ) == -1 ) {
+         if ( errno == ENOENT && paths.size() > 1 )
+            continue;
+         int err = errno;
+         close();
+         errno = err;
+         return -1;
+      }
+   }
+   seg_ = 0;
+   at_ = segs_.empty() ? 0 : segs_[0].first;
+   open_ = true;
+   truncated_ = false;
+   counted_ = false;
+   settle();
+   return 0;
 }
 
 
-//! @returns true if the file stream is okay
+//! @brief Private routine to map a file and add it to the segments.
+//! @returns 0, or -1 with errno set.
+int BinaryDataReader::map( const std::string& path )
+{
+   int fd = ::open( path.c_str(), O_RDONLY|O_CLOEXEC );
+   if ( fd == -1 )
+      return -1;
+   struct stat st;
+   if ( fstat( fd, &st ) == -1 ) {
+      ::close( fd );
+      return -1;
+   }
+   Segment seg;
+   seg.base = 0;
+   seg.size = st.st_size;
+   if ( seg.size > 0 ) {
+      void* p = mmap( 0, seg.size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      if ( p == MAP_FAILED ) {
+         ::close( fd );
+         return -1;
+      }
+      // The file is read front to back: read ahead hard and drop pages
+      // soon after they have been passed.
+      madvise( p, seg.size, MADV_SEQUENTIAL );
+      seg.base = (const char*) p;
+   }
+   ::close( fd );     // the mapping stays
+
+   RecordFormat::FileHeader fh;
+   if ( fh.get( seg.base, seg.size ) ) {
+      if ( fh.version == 0 || fh.recordLen < RecordFormat::RECORD_HEADER_LEN ) {
+         munmap( (void*) seg.base, seg.size );
+         errno = EINVAL;
+         return -1;
+      }
+      seg.version = fh.version;
+      seg.headerLen = fh.recordLen;
+      seg.realtimeOffset = fh.realtimeOffset;
+      seg.first = seg.base + RecordFormat::FILE_HEADER_LEN;
+   }
+   else {
+      seg.version = 0;
+      seg.headerLen = RecordFormat::V0_HEADER_LEN;
+      seg.realtimeOffset = 0;
+      seg.first = seg.base;
+   }
+   seg.records = NOT_COUNTED;
+   seg.start = 0;
+   segs_.push_back( seg );
+   if ( seg.version > 0 )
+      loadIndex( segs_.back(), path + ".idx" );
+   return 0;
+}
+
+
+//! Unmaps the file.  The views handed out are no good after this.
+void BinaryDataReader::close()
+{
+   for( size_t i=0; i < segs_.size(); ++i ) {
+      if ( segs_[i].base )
+         munmap( (void*) segs_[i].base, segs_[i].size );
+   }
+   segs_.clear();
+   seg_ = 0;
+   at_ = 0;
+   open_ = false;
+}
+
+
+//! @returns true if the file is open and no record cut short has been
+//!          come to.
 bool BinaryDataReader::good() const
 {
-   return fd_.good();
+   return open_ && ! truncated_;
+}
+
+
+//! @returns the RecordFormat version of the segment being read, 0 for
+//!          the first one.
+unsigned int BinaryDataReader::version() const
+{
+   if ( segs_.empty() )
+      return 0;
+   return segs_[std::min( seg_, segs_.size()-1 )].version;
+}
+
+
+//! @returns what to add to a record time of the segment being read to
+//!          make it CLOCK_REALTIME, or 0 if the file doesn't say.
+int64_t BinaryDataReader::realtimeOffset() const
+{
+   if ( segs_.empty() )
+      return 0;
+   return segs_[std::min( seg_, segs_.size()-1 )].realtimeOffset;
+}
+
+
+//! Private routine to move next() on to the following segment, or past
+//! the last one, once it is at the end of one.
+void BinaryDataReader::settle()
+{
+   while( seg_ < segs_.size() && at_ == segs_[seg_].base + segs_[seg_].size ) {
+      if ( ++seg_ < segs_.size() )
+         at_ = segs_[seg_].first;
+   }
+}
+
+
+//! @brief  Reads the next record of the file.
+//!
+//! @param v  set to the record.
+//! @returns true, or false if there are no more records.
+bool BinaryDataReader::next( RecordView& v )
+{
+   for( ;; ) {
+      if ( eof() )
+         return false;
+      const Segment& seg = segs_[seg_];
+      const char* n = parse( seg, at_, v );
+      if ( n ) {
+         at_ = n;
+         settle();
+         return true;
+      }
+      // cut short, go on with the next segment.
+      truncated_ = true;
+      at_ = seg.base + seg.size;
+      settle();
+   }
 }
 
 
-//! @brief Returns the next buffer of the proper transfer type.  If no more
-//!        buffers exist, the routine will return null.
+//! @brief Reads the next record of the proper transfer type, passing over
+//!        the others.
 //!
-//! @returns  a dynamically allocated buffer which contains all the data
-//!           from the next frame with transfer type tt. OR null if there
-//!           are no more buffers of type tt.
-Buffer* BinaryDataReader::getNext( const TransferType& tt )
+//! @param v   set to the record.
+//! @param tt  the transfer type wanted.
+//! @returns true, or false if there are no more records of type tt.
+bool BinaryDataReader::next( RecordView& v, const TransferType& tt )
 {
-   Buffer* pB = 0;
-   while ( (pB=mkBuffer()) != 0 && pB->type != tt ) {
-      delete pB;  // throw buffers of wrong type away!
+   while ( next( v ) ) {
+      if ( v.type == tt )
+         return true;
    }
-   return pB;
+   return false;
 }
 
 
-//! @brief  Returns next Buffer in datafile.
+//! @brief Private routine to read the index file of a segment, if there
+//!        is one.
 //!
-//! This routine is different from its cousin which takes an TransferType argument
-//! in that this routine returns the next buffer in the file regardless of its 
-//! transmission type.
+//! Entries which don't make sense for the file, as past its end when the
+//! recorder was cut off before the records were written, end the index.
 //!
-//! @returns a dynamically allocated Buffer, or NULL if the eof has been reached.
-Buffer* BinaryDataReader::getNext()
+//! @param seg   the segment.
+//! @param path  the index file.
+void BinaryDataReader::loadIndex( Segment& seg, const std::string& path )
 {
-   return mkBuffer();
+   seg.index.clear();
+   int fd = ::open( path.c_str(), O_RDONLY|O_CLOEXEC );
+   if ( fd == -1 )
+      return;
+   std::vector<char> data;
+   char buf[64*1024];
+   ssize_t n;
+   while( (n = ::read( fd, buf, sizeof(buf) )) > 0 || (n == -1 && errno == EINTR) ) {
+      if ( n > 0 )
+         data.insert( data.end(), buf, buf + n );
+   }
+   ::close( fd );
+
+   if ( data.size() < RecordFormat::INDEX_HEADER_LEN
+        || memcmp( &data[0], RecordFormat::INDEX_MAGIC,
+                   sizeof(RecordFormat::INDEX_MAGIC) ) )
+      return;
+   for( size_t at = RecordFormat::INDEX_HEADER_LEN;
+        at + RecordFormat::INDEX_ENTRY_LEN <= data.size();
+        at += RecordFormat::INDEX_ENTRY_LEN ) {
+      RecordFormat::IndexEntry e;
+      e.get( &data[at] );
+      if ( e.offset < (uint64_t) (seg.first - seg.base) || e.offset >= seg.size )
+         break;
+      if ( ! seg.index.empty() && ( e.record <= seg.index.back().record
+                                    || e.offset <= seg.index.back().offset ) )
+         break;
+      seg.index.push_back( e );
+   }
 }
 
 
+//! Orders index entries by record number.
+static bool recordBefore( uint64_t n, const RecordFormat::IndexEntry& e )
+{
+   return n < e.record;
+}
+
 
-//! @brief  Check for end of file marker.
+//! Orders index entries by time.
+static bool timeBefore( const RecordFormat::IndexEntry& e, uint64_t t )
+{
+   return e.time < t;
+}
+
+
+//! @brief Private routine to move next() to n records on from at, in the
+//!        segment being read.
+//! @returns false if there is no whole record there.
+bool BinaryDataReader::skip( const char* at, uint64_t n )
+{
+   RecordView v;
+   at_ = at;
+   settle();
+   for( ; n > 0; --n ) {
+      if ( ! next( v ) )
+         return false;
+   }
+   // Look, without moving, for a whole record.
+   size_t seg = seg_;
+   const char* here = at_;
+   bool found = next( v );
+   seg_ = seg;
+   at_ = here;
+   return found;
+}
+
+
+//! @brief Private routine to count the records of every segment, so that
+//!        a record number can be put in a segment.
 //!
-//! True if the end of file marker has been read by the stream.
+//! Only what comes after the last index entry of a segment is scanned.
+void BinaryDataReader::count()
+{
+   if ( counted_ )
+      return;
+   uint64_t start = 0;
+   for( size_t i=0; i < segs_.size(); ++i ) {
+      Segment& seg = segs_[i];
+      if ( seg.records == NOT_COUNTED ) {
+         const char* at = seg.first;
+         uint64_t n = 0;
+         if ( ! seg.index.empty() ) {
+            at = seg.base + seg.index.back().offset;
+            n = seg.index.back().record;
+         }
+         RecordView v;
+         while( at && (at = parse( seg, at, v )) != 0 )
+            ++n;
+         seg.records = n;
+      }
+      seg.start = start;
+      start += seg.records;
+   }
+   counted_ = true;
+}
+
+
+//! @brief Moves next() to a record by its number.
+//!
+//! @param n  the record, from 0, counted across every segment.
+//! @returns true, or false if the file has fewer records.
+bool BinaryDataReader::seekToRecord( uint64_t n )
+{
+   if ( ! open_ || segs_.empty() )
+      return false;
+   truncated_ = false;
+   count();
+
+   // the last segment starting at or before n.
+   size_t lo = 0, hi = segs_.size();
+   while( lo < hi ) {
+      size_t mid = (lo + hi) / 2;
+      if ( segs_[mid].start <= n )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   const Segment& seg = segs_[lo - 1];
+   if ( n - seg.start >= seg.records ) {
+      seg_ = segs_.size();
+      at_ = 0;
+      return false;
+   }
+   seg_ = lo - 1;
+   n -= seg.start;
+
+   std::vector<RecordFormat::IndexEntry>::const_iterator e =
+      std::upper_bound( seg.index.begin(), seg.index.end(), n, recordBefore );
+   if ( e == seg.index.begin() )
+      return skip( seg.first, n );
+   --e;
+   return skip( seg.base + e->offset, n - e->record );
+}
+
+
+//! @returns the time of the first record of a segment, or NOT_COUNTED if
+//!          it has none.
+uint64_t BinaryDataReader::firstTime( const Segment& seg ) const
+{
+   RecordView v;
+   return ( seg.first && parse( seg, seg.first, v ) ) ? v.time : NOT_COUNTED;
+}
+
+
+//! @brief Moves next() to the first record read at or after a time.
+//!
+//! Records are taken to be in the order of their times, as the recorder
+//! writes them, and so are the segments.  In version 0 files, which have
+//! no times, this is the first record.
+//!
+//! @param t  CLOCK_MONOTONIC in nsec, as RecordView::time.
+//! @returns true, or false if there is no record from then on.
+bool BinaryDataReader::seekToTime( uint64_t t )
+{
+   if ( ! open_ || segs_.empty() )
+      return false;
+   truncated_ = false;
+
+   // the last segment whose first record is at or before t.
+   size_t lo = 0, hi = segs_.size();
+   while( lo < hi ) {
+      size_t mid = (lo + hi) / 2;
+      if ( firstTime( segs_[mid] ) <= t )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   seg_ = ( lo > 0 ) ? lo - 1 : 0;
+   const Segment& seg = segs_[seg_];
+   std::vector<RecordFormat::IndexEntry>::const_iterator e =
+      std::lower_bound( seg.index.begin(), seg.index.end(), t, timeBefore );
+   at_ = ( e != seg.index.begin() ) ? seg.base + (e-1)->offset : seg.first;
+   settle();
+
+   // then on to the first record from t.
+   RecordView v;
+   for( ;; ) {
+      size_t s = seg_;
+      const char* at = at_;
+      if ( ! next( v ) )
+         return false;
+      if ( v.time >= t ) {
+         seg_ = s;
+         at_ = at;
+         return true;
+      }
+   }
+}
+
+
+//! @brief  Check for end of file.
 //!
-//! @returns  true if the stream has reached the eof.  false if not.
-bool BinaryDataReader::eof() const 
+//! @returns  true if every record has been read.  false if not.
+bool BinaryDataReader::eof() const
 {
-   return fd_.eof();
+   return seg_ >= segs_.size();
 }
 
 } // end namespace ntee
@@ -1,35 +1,159 @@
 #ifndef INCLUDED_BinaryDataReader_HPP
 #define INCLUDED_BinaryDataReader_HPP
 
-#include <fstream>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <stdint.h>
 #include "Buffer.hpp"
-#include "NTee.hpp"
+#include "RecordFormat.hpp"
 
 namespace ntee {
 
 
+//! @brief One record of a data file, as it lies in the file.
+//!
+//! data points into the reader's mapping of the file, so a view is only
+//! good for as long as its BinaryDataReader is open.  Version 0 files
+//! carry neither times, sequence numbers nor sessions, and leave them 0.
+struct RecordView {
+   TransferType type;     //!< direction of the message
+   const char* data;      //!< payload
+   uint32_t len;          //!< length in bytes of the payload
+   uint64_t time;         //!< CLOCK_MONOTONIC in nsec when it was read
+   uint64_t seq;          //!< number of the record in its direction
+   unsigned int session;  //!< id of the session it belongs to
+};
+
+
 //! @brief  Reads a data file which is in binary compressed format
 //!
+//! The whole file is mapped into memory, and each record is handed out as
+//! a RecordView of the mapping, so reading does neither allocate nor copy.
+//! Records are read in order, either one at a time with next() or with an
+//! iterator from begin() to end().  Files of every RecordFormat version
+//! are read, the headerless version 0 included.
+//!
+//! Given the manifest of a recording split into segments (see SegmentSet)
+//! every segment is mapped, and they are read one after the other as if
+//! they were one file.  Segments which have been removed are left out.
+//!
+//! next() can be moved to a record by number or by time with
+//! seekToRecord() and seekToTime().  These start from the nearest entry
+//! of the file's sparse index, if it has one, and so take a binary search
+//! and a short scan rather than a scan of the file.
+//!
+//! A record cut short by the end of the file, as left by a recorder which
+//! didn't get to shut down, ends the data of that file; good() turns false
+//! once it has been come to.
 class BinaryDataReader {
 public:
 
+   //! @brief Forward iterator over the records of the file.
+   class iterator {
+   public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef RecordView value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const RecordView* pointer;
+      typedef const RecordView& reference;
+
+      iterator() : reader_(0), seg_(0), at_(0), next_(0) {}
+
+      reference operator*() const { return view_; }
+      pointer operator->() const { return &view_; }
+      iterator& operator++() { load( seg_, next_ ); return *this; }
+      iterator operator++(int) { iterator i(*this); ++*this; return i; }
+      bool operator==( const iterator& o ) const
+      {
+         return seg_ == o.seg_ && at_ == o.at_;
+      }
+      bool operator!=( const iterator& o ) const { return ! (*this == o); }
+
+   private:
+      friend class BinaryDataReader;
+      iterator( const BinaryDataReader* r, size_t seg, const char* at )
+       : reader_(r)
+      {
+         load( seg, at );
+      }
+      void load( size_t seg, const char* at );
+
+      const BinaryDataReader* reader_;
+      size_t seg_;         //!< segment of the record, all of them at the end
+      const char* at_;     //!< the record viewed, NULL at the end
+      const char* next_;   //!< the record after it
+      RecordView view_;
+   };
+
+   BinaryDataReader();
+   ~BinaryDataReader();
+
    int open(const std::string& file);
-   
-   Buffer* getNext( const TransferType& tt );
-   Buffer* getNext();
+   void close();
+
+   bool next( RecordView& v );
+   bool next( RecordView& v, const TransferType& tt );
+
+   bool seekToRecord( uint64_t n );
+   bool seekToTime( uint64_t t );
+
+   //! @returns an iterator at the first record of the file.
+   iterator begin() const
+   {
+      return iterator( this, 0, segs_.empty() ? 0 : segs_[0].first );
+   }
+
+   //! @returns the iterator past the last whole record of the file.
+   iterator end() const { return iterator( this, segs_.size(), 0 ); }
+
+   //! @returns an iterator at the record next() would read.
+   iterator position() const { return iterator( this, seg_, at_ ); }
 
    bool good() const;
    bool eof() const;
-   
-   
+
+   unsigned int version() const;
+   int64_t realtimeOffset() const;
+
 private:
-   Buffer* mkBuffer();
+   BinaryDataReader( const BinaryDataReader& );
+   BinaryDataReader& operator=( const BinaryDataReader& );
+
+   //! Number of records of a segment not counted yet.
+   static const uint64_t NOT_COUNTED = ~0ULL;
 
-private:   
-   std::ifstream fd_;   //!< The file
+   //! One file, mapped.
+   struct Segment {
+      const char* base;    //!< the mapping, NULL when the file is empty
+      size_t size;         //!< length of the file
+      const char* first;   //!< the first record, after any file header
+      unsigned int version;
+      size_t headerLen;    //!< length of each record header
+      int64_t realtimeOffset;
+      std::vector<RecordFormat::IndexEntry> index;   //!< the sparse index
+      uint64_t records;    //!< whole records in it, or NOT_COUNTED
+      uint64_t start;      //!< number of its first record in the set
+   };
+
+   int map( const std::string& path );
+   void loadIndex( Segment& seg, const std::string& path );
+   const char* parse( const Segment& seg, const char* at,
+                      RecordView& v ) const;
+   void settle();
+   bool skip( const char* at, uint64_t n );
+   void count();
+   uint64_t firstTime( const Segment& seg ) const;
+
+   std::vector<Segment> segs_;
+   size_t seg_;         //!< segment next() reads from
+   const char* at_;     //!< next record to be read by next()
+   bool open_;          //!< a file is open
+   bool truncated_;     //!< next() came to a record cut short
+   bool counted_;       //!< every segment has been counted
 };
 
 } // end namespace ntee
 
 #endif
-
@@ -1,34 +1,171 @@
 #include "BinaryDataRecorder.hpp"
-#include <fstream>
+#include "Error.hpp"
+#include "comm.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace ntee {
 
+BinaryDataRecorder::BinaryDataRecorder()
+ : idx_(-1), records_(0)
+{
+   seq_[L_to_R] = seq_[R_to_L] = 0;
+}
+
+
+BinaryDataRecorder::~BinaryDataRecorder()
+{
+   shutdown();
+}
+
+
+//! @brief Opens the file and its index, and writes their headers.
+//!
+//! Given a segment size or age, the recording is split into segments,
+//! and filename becomes the manifest of them; see SegmentSet.
+//!
+//! @param filename      the file.
+//! @param segmentBytes  size at which to start a new segment, 0 for none.
+//! @param segmentSecs   age at which to start a new segment, 0 for none.
 //! @returns 0 when everything is okay, -1 if there were problems with
 //!          opening the file.
-int BinaryDataRecorder::open( const std::string& s )
+int BinaryDataRecorder::open( const std::string& filename,
+                              uint64_t segmentBytes, unsigned segmentSecs )
+{
+   std::string path = filename;
+   if ( segmentBytes || segmentSecs ) {
+      if ( segs_.open( filename, segmentBytes, segmentSecs ) == -1 )
+         return -1;
+      path = segs_.path();
+   }
+   if ( out_.open( path, segs_.maxBytes() ) == -1 )
+      return -1;
+   timespec now;
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   if ( segs_.enabled() )
+      segs_.opened( now );
+   seq_[L_to_R] = seq_[R_to_L] = 0;
+   start( path );
+   return 0;
+}
+
+
+//! @brief Private routine to write the file header of a new file, and
+//!        to start its index.
+//! @param path  the file.
+void BinaryDataRecorder::start( const std::string& path )
+{
+   timespec mono, real;
+   clock_gettime( CLOCK_MONOTONIC, &mono );
+   clock_gettime( CLOCK_REALTIME, &real );
+
+   RecordFormat::FileHeader fh;
+   fh.version = RecordFormat::VERSION;
+   fh.recordLen = RecordFormat::RECORD_HEADER_LEN;
+   fh.realtimeOffset = (real.tv_sec - mono.tv_sec) * 1000000000LL 
+                       + real.tv_nsec - mono.tv_nsec;
+   fh.put( out_.room( RecordFormat::FILE_HEADER_LEN ) );
+   out_.commit( RecordFormat::FILE_HEADER_LEN );
+   records_ = 0;
+
+   if ( idx_ != -1 )
+      ::close( idx_ );
+   idx_ = -1;
+
+   // Only a file can be sought in, not a pipe or a device.
+   struct stat st;
+   if ( stat( path.c_str(), &st ) == -1 || ! S_ISREG(st.st_mode) )
+      return;
+   std::string idx = path + ".idx";
+   idx_ = ::open( idx.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666 );
+   WarnIf( idx_ == -1 ).info("Recording without an index, can't open %s: %s\n",
+                             idx.c_str(), strerror(errno));
+   if ( idx_ != -1 ) {
+      char h[RecordFormat::INDEX_HEADER_LEN] = { 0 };
+      uint16_t v = htole16( RecordFormat::VERSION );
+      memcpy( h, RecordFormat::INDEX_MAGIC, sizeof(RecordFormat::INDEX_MAGIC) );
+      memcpy( h + 8, &v, sizeof(v) );
+      indexWrite( h, sizeof(h) );
+   }
+}
+
+
+//! @brief Private routine to move on to the next segment.  The sequence
+//!        numbers run on across segments, the record numbers of the index
+//!        start again.
+//! @param now  time of the record about to be written.
+void BinaryDataRecorder::roll( const timespec& now )
+{
+   std::string path = segs_.path();
+   if ( out_.rotate( path, segs_.maxBytes() ) == -1 ) {
+      segs_.failed();
+      return;
+   }
+   segs_.opened( now );
+   start( path );
+}
+
+
+//! @brief Adds b, the record about to be written, to the index if it is
+//!        the first or far enough on from the latest entry.
+void BinaryDataRecorder::index( const Buffer& b )
+{
+   if ( records_ != 0 && records_ - last_.record < RecordFormat::INDEX_RECORDS
+        && out_.tell() - last_.offset < RecordFormat::INDEX_BYTES )
+      return;
+   last_.record = records_;
+   last_.time = b.ts.tv_sec * 1000000000ULL + b.ts.tv_nsec;
+   last_.offset = out_.tell();
+   char e[RecordFormat::INDEX_ENTRY_LEN];
+   last_.put( e );
+   indexWrite( e, sizeof(e) );
+}
+
+
+//! Writes to the index file, giving it up if that fails.
+void BinaryDataRecorder::indexWrite( const char* p, size_t n )
 {
-   using namespace std;
-   fd_.open( s.c_str(), fstream::out|fstream::binary );
-   return (fd_.good())?0:-1;
+   if ( write_n( idx_, p, n ) != n ) {
+      WarnIf( true ).info("Index given up, write failed: %s\n", strerror(errno));
+      ::close( idx_ );
+      idx_ = -1;
+   }
 }
 
 
-//! recorder method implementations
-void BinaryDataRecorder::record( const Socket& from, const Socket& to,
-                                 const char* buf, size_t len )
+//! recorder method implementations.  Records of all sessions are
+//! interleaved in the order they were read, each stamped with its session
+//! and the time it was read.
+void BinaryDataRecorder::record( const Buffer& b )
 {
-   // First element of the record is the direction
-   char dest = ( from.name() == "L" )?'R':'L';   // destination transmission
-   uint32_t llen = htonl(len); 
-   fd_.write( &dest, sizeof(char));
-   fd_.write( reinterpret_cast<char*>( &llen ), sizeof(uint32_t));
-   fd_.write( buf, len );
+   if ( segs_.due( out_.tell(), b.ts ) )
+      roll( b.ts );
+   if ( idx_ != -1 )
+      index( b );
+   RecordFormat::RecordHeader h;
+   h.time = b.ts.tv_sec * 1000000000ULL + b.ts.tv_nsec;
+   h.seq = seq_[b.type]++;
+   h.session = b.session;
+   h.len = b.size();
+   h.dest = ( b.type == L_to_R )?'R':'L';   // destination transmission
+   h.put( out_.room( RecordFormat::RECORD_HEADER_LEN ) );
+   out_.commit( RecordFormat::RECORD_HEADER_LEN );
+   out_.append( b );
+   ++records_;
 }
 
 
 void BinaryDataRecorder::shutdown() {
-   fd_.close();
+   out_.close();
+   if ( idx_ != -1 )
+      ::close( idx_ );
+   idx_ = -1;
+   segs_.close();
 }
 
 } // end namespace ntee
@@ -2,25 +2,45 @@
 #define INCLUDED_BinaryDataRecorder_HPP
 
 #include "NTee.hpp"
-#include <fstream>
+#include "BlockWriter.hpp"
+#include "RecordFormat.hpp"
+#include "SegmentSet.hpp"
 
 namespace ntee {
 
+//! @brief Records the messages to a binary data file, laid out as in
+//!        RecordFormat.
+//!
+//! The sparse index of the file is written to <file>.idx as the records
+//! go in, so that even the file of a recorder which didn't get to shut
+//! down can be sought in.  Without the index file the recording still
+//! goes ahead.  A recording split into segments has an index for each.
 class BinaryDataRecorder : public Recorder {
 public:
+   BinaryDataRecorder();
+   ~BinaryDataRecorder();
 
-   //! Open a file
-   int open(const std::string& filename);
+   int open( const std::string& filename, uint64_t segmentBytes = 0,
+             unsigned segmentSecs = 0 );
    
    //! recorder method implementations
-   void record( const Socket& from, const Socket& to,
-                const char* buf, size_t len );              
+   void record( const Buffer& );              
    
    //! Close and release any resources
    void shutdown();
 
 private:
-   std::ofstream fd_;  //!< The file stream
+   void start( const std::string& path );
+   void roll( const timespec& now );
+   void index( const Buffer& );
+   void indexWrite( const char* p, size_t n );
+
+   BlockWriter out_;  //!< The file
+   SegmentSet segs_;  //!< the segments, when the recording is split
+   uint64_t seq_[2];  //!< next sequence number, by TransferType
+   int idx_;          //!< the index file, -1 if there is none
+   uint64_t records_; //!< records written to the file so far
+   RecordFormat::IndexEntry last_;  //!< the latest index entry
 };
 
 } // end namespace ntee
@@ -0,0 +1,389 @@
+#include "BlockWriter.hpp"
+#include "Error.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+namespace ntee {
+
+const size_t BlockWriter::BLOCK_BYTES;
+const size_t BlockWriter::BLOCKS;
+const unsigned BlockWriter::FLUSH_MSEC;
+
+//! Alignment of the staging blocks.
+static const size_t BLOCK_ALIGN = 4096;
+
+
+//! Makes an unopened writer.
+BlockWriter::BlockWriter()
+ : fd_(-1), written_(0), cur_(0), used_(0), pos_(0), staged_(0), 
+   partial_(0), partialLen_(0), done_(false), failed_(false)
+{
+   // empty
+}
+
+
+//! Writes out whatever is still staged.
+BlockWriter::~BlockWriter()
+{
+   close();
+}
+
+
+//! @brief Private routine to create, or truncate, a file.
+//!
+//! @param path      The file.
+//! @param prealloc  Bytes to set aside for the file, 0 for none.  Not
+//!                  every file system can, and then none are.
+//! @returns the file descriptor, or -1 with errno set.
+int BlockWriter::create( const std::string& path, uint64_t prealloc )
+{
+   int fd = ::open( path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666 );
+   if ( fd != -1 && prealloc > 0 )
+      fallocate( fd, FALLOC_FL_KEEP_SIZE, 0, prealloc );
+   return fd;
+}
+
+
+//! @brief Creates, or truncates, the file and starts the flusher.
+//!
+//! @param path      The file.
+//! @param prealloc  Bytes to set aside for the file, 0 for none.
+//! @returns 0 when everything is okay, -1 with errno set if the file
+//!          couldn't be opened.
+int BlockWriter::open( const std::string& path, uint64_t prealloc )
+{
+   fd_ = create( path, prealloc );
+   if ( fd_ == -1 )
+      return -1;
+   written_ = 0;
+   pos_ = 0;
+   for( size_t i=0; i < BLOCKS; ++i ) {
+      void* p;
+      if ( posix_memalign( &p, BLOCK_ALIGN, BLOCK_BYTES ) != 0 )
+         throw std::bad_alloc();
+      blocks_.push_back( (char*) p );
+      free_.push_back( (char*) p );
+   }
+   done_ = false;
+   staged_ = 0;
+   partial_ = 0;
+   thread_.reset( new boost::thread( boost::bind(&BlockWriter::flush, this) ) );
+   return 0;
+}
+
+
+//! @brief Moves the output on to another file.
+//!
+//! The file is opened here, so that a failure can be told, but the
+//! flusher only switches to it after writing out everything put in
+//! before.  It then closes the old file.
+//!
+//! @param path      The file.
+//! @param prealloc  Bytes to set aside for the file, 0 for none.
+//! @returns 0 when everything is okay, -1 with errno set if the file
+//!          couldn't be opened, in which case the output stays where it
+//!          was.
+int BlockWriter::rotate( const std::string& path, uint64_t prealloc )
+{
+   int fd = create( path, prealloc );
+   if ( fd == -1 )
+      return -1;
+   push();
+   Entry e;
+   e.block = 0;
+   e.len = 0;
+   e.fd = fd;
+   queue( e );
+   pos_ = 0;
+   return 0;
+}
+
+
+//! @brief Writes out everything staged, stops the flusher and closes the
+//!        file.  Safe to call more than once.
+void BlockWriter::close()
+{
+   if ( ! thread_ )
+      return;
+   push();
+   {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      done_ = true;
+   }
+   work_.notify_one();
+   thread_->join();
+   thread_.reset();
+
+   finish();
+   for( size_t i=0; i < blocks_.size(); ++i )
+      free( blocks_[i] );
+   blocks_.clear();
+   free_.clear();
+}
+
+
+//! @brief Private routine to close the file being written, trimmed to
+//!        what was written so that any space preallocated past that is
+//!        given back.
+void BlockWriter::finish()
+{
+   if ( fd_ == -1 )
+      return;
+   struct stat st;
+   if ( fstat( fd_, &st ) == 0 && S_ISREG(st.st_mode) )
+      ftruncate( fd_, written_ );
+   ::close( fd_ );
+   fd_ = -1;
+}
+
+
+//! @brief Finds room for n contiguous bytes.
+//!
+//! The caller writes up to n bytes there and then commit()s what it used.
+//!
+//! @param n   Bytes needed, no more than BLOCK_BYTES.
+//! @returns where to write them.
+char* BlockWriter::room( size_t n )
+{
+   if ( cur_ && used_.load( boost::memory_order_relaxed ) + n > BLOCK_BYTES )
+      push();
+   if ( ! cur_ )
+      cur_ = take();
+   return cur_ + used_;
+}
+
+
+//! Copies n bytes to the output.
+void BlockWriter::append( const void* p, size_t n )
+{
+   const char* c = (const char*) p;
+   while( n > 0 ) {
+      char* to = room( 1 );
+      size_t len = std::min( n, BLOCK_BYTES - (to - cur_) );
+      memcpy( to, c, len );
+      commit( len );
+      c += len;
+      n -= len;
+   }
+}
+
+
+//! @brief Adds the payload of a message, all of its segments, to the
+//!        output.
+//!
+//! A reference counted message bigger than a block is queued as is, the
+//! rest is copied.
+void BlockWriter::append( const Buffer& b )
+{
+   if ( b.shared() && b.size() > BLOCK_BYTES ) {
+      push();
+      Entry e;
+      e.block = 0;
+      e.len = 0;
+      e.msg = const_cast<Buffer*>( &b );
+      e.fd = -1;
+      queue( e );
+      pos_ += b.size();
+      return;
+   }
+   for( const Buffer* seg = &b; seg; seg = seg->next.get() )
+      append( seg->buf, seg->len );
+}
+
+
+//! Hands the block being filled, if it holds anything, to the flusher.
+void BlockWriter::push()
+{
+   if ( ! cur_ || used_.load( boost::memory_order_relaxed ) == 0 )
+      return;
+   Entry e;
+   e.block = cur_;
+   e.len = used_.load( boost::memory_order_relaxed );
+   e.fd = -1;
+   queue( e );
+   cur_ = 0;
+   used_.store( 0, boost::memory_order_relaxed );
+}
+
+
+//! Hands an entry to the flusher.
+void BlockWriter::queue( const Entry& e )
+{
+   {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      full_.push_back( e );
+      if ( e.block )
+         staged_ = 0;
+   }
+   work_.notify_one();
+}
+
+
+//! @returns an empty block, waiting for the flusher to free one if need be.
+char* BlockWriter::take()
+{
+   boost::unique_lock<boost::mutex> lock( mutex_ );
+   while( free_.empty() )
+      freed_.wait( lock );
+   char* b = free_.back();
+   free_.pop_back();
+   staged_ = b;
+   return b;
+}
+
+
+//! @brief Flusher thread main loop.
+//!
+//! Takes every entry waiting and writes them all with one writev() (or
+//! as few as IOV_MAX allows) per file, then hands the blocks back.  If
+//! nothing comes for FLUSH_MSEC, what is in the block being filled is
+//! written out instead, and only the rest of it once it comes.  After a
+//! failed write the entries are still taken, so that the recorder never
+//! blocks, but nothing more is written.
+void BlockWriter::flush()
+{
+   std::deque<Entry> batch;
+   std::vector<iovec> iov;
+   for( ;; ) {
+      {
+         boost::unique_lock<boost::mutex> lock( mutex_ );
+         if ( full_.empty() && ! done_ )
+            work_.wait_for( lock, boost::chrono::milliseconds(FLUSH_MSEC) );
+         if ( full_.empty() ) {
+            if ( done_ )
+               return;
+            lock.unlock();
+            flushStaged();
+            continue;
+         }
+         batch.swap( full_ );
+      }
+
+      iov.clear();
+      for( size_t i=0; i < batch.size(); ++i ) {
+         if ( batch[i].block ) {
+            // Less what was written of it while it was being filled
+            size_t skip = 0;
+            if ( batch[i].block == partial_ ) {
+               skip = std::min( partialLen_, batch[i].len );
+               partial_ = 0;
+            }
+            iovec v = { batch[i].block + skip, batch[i].len - skip };
+            if ( v.iov_len > 0 )
+               iov.push_back( v );
+         }
+         else if ( batch[i].msg ) {
+            for( const Buffer* seg = batch[i].msg.get(); seg; 
+                 seg = seg->next.get() ) {
+               iovec v = { (void*) seg->buf, (size_t) seg->len };
+               iov.push_back( v );
+            }
+         }
+         else {
+            write( iov );
+            iov.clear();
+            finish();
+            fd_ = batch[i].fd;
+            written_ = 0;
+         }
+      }
+      write( iov );
+
+      {
+         boost::lock_guard<boost::mutex> lock( mutex_ );
+         for( size_t i=0; i < batch.size(); ++i ) {
+            if ( batch[i].block )
+               free_.push_back( batch[i].block );
+         }
+      }
+      freed_.notify_one();
+      batch.clear();      // lets go of the messages
+   }
+}
+
+
+//! @brief Private routine for the flusher to write out what has been put
+//!        in the block being filled, past what it wrote of it before.
+//!
+//! Everything handed to the flusher before has been written, and the
+//! bytes of the block up to used_ are left alone by the recorder until
+//! the block comes back, so they can be written as they are.
+void BlockWriter::flushStaged()
+{
+   char* block;
+   size_t len;
+   {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      if ( ! full_.empty() )
+         return;      // written in order with the rest
+      block = staged_;
+      len = used_.load( boost::memory_order_acquire );
+   }
+   if ( ! block )
+      return;
+   if ( block != partial_ ) {
+      partial_ = block;
+      partialLen_ = 0;
+   }
+   if ( len <= partialLen_ )
+      return;
+   std::vector<iovec> iov( 1 );
+   iov[0].iov_base = block + partialLen_;
+   iov[0].iov_len = len - partialLen_;
+   write( iov );
+   partialLen_ = len;
+}
+
+
+//! Writes a gather list to the file, unless a write has failed before.
+void BlockWriter::write( std::vector<iovec>& iov )
+{
+   if ( failed_ || iov.empty() )
+      return;
+   if ( ! writeAll( iov ) ) {
+      WarnIf( true ).info("Recording stopped, write failed: %s\n",
+                          strerror(errno));
+      failed_ = true;
+   }
+}
+
+
+//! @brief Writes a gather list in full, IOV_MAX entries at a time.
+//! @returns false, with errno set, if a write failed.
+bool BlockWriter::writeAll( std::vector<iovec>& iov )
+{
+   iovec* v = iov.empty() ? 0 : &iov[0];
+   size_t n = iov.size();
+   while( n > 0 ) {
+      ssize_t w = ::writev( fd_, v, std::min( n, (size_t) IOV_MAX ) );
+      if ( w == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         return false;
+      }
+      // step over what was written.
+      written_ += w;
+      size_t left = w;
+      while( n > 0 && left >= v->iov_len ) {
+         left -= v->iov_len;
+         ++v;
+         --n;
+      }
+      if ( n > 0 ) {
+         v->iov_base = (char*) v->iov_base + left;
+         v->iov_len -= left;
+      }
+   }
+   return true;
+}
+
+} // end namespace ntee
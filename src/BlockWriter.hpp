@@ -0,0 +1,118 @@
+#ifndef INCLUDED_BLOCKWRITER_HPP
+#define INCLUDED_BLOCKWRITER_HPP
+
+#include "Buffer.hpp"
+#include <deque>
+#include <string>
+#include <stdint.h>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace ntee {
+
+//! @brief Buffered file output shared by the recorders.
+//!
+//! Records are put together in large, page aligned staging blocks.  A
+//! full block is handed to a flusher thread, which writes out every block
+//! waiting with a single writev(), while the recorder carries on filling
+//! the next one.  Only BLOCKS blocks exist, so a recorder which outruns
+//! the disk waits for one to come back.  A message bigger than a block is
+//! not copied at all: a reference to its segments is queued behind the
+//! blocks, and the flusher writes it straight from the pool.  So that a
+//! quiet recording still reaches the file as it goes, rather than only
+//! when a block fills up, the flusher writes out what has been put in the
+//! block being filled once nothing was handed to it for FLUSH_MSEC.
+//!
+//! The output can be moved on to another file with rotate(), which takes
+//! effect in order: everything put in before it goes to the old file, the
+//! flusher then trims the old file and closes it.  A file may be
+//! preallocated, so that it is laid out in one piece as it fills; the
+//! space not used is given back when it is closed.
+//!
+//! One thread puts records in, the flusher takes them out.
+class BlockWriter {
+public:
+   //! Size in bytes of each staging block.
+   static const size_t BLOCK_BYTES = 1024*1024;
+
+   //! Number of staging blocks.
+   static const size_t BLOCKS = 4;
+
+   //! Most milliseconds what was put in waits to be written out.
+   static const unsigned FLUSH_MSEC = 200;
+
+   BlockWriter();
+   ~BlockWriter();
+
+   int open( const std::string& path, uint64_t prealloc = 0 );
+   int rotate( const std::string& path, uint64_t prealloc = 0 );
+   void close();
+
+   char* room( size_t n );
+
+   //! Adds the n bytes written at room() to the output.
+   void commit( size_t n )
+   {
+      used_.store( used_.load( boost::memory_order_relaxed ) + n,
+                   boost::memory_order_release );
+      pos_ += n;
+   }
+
+   //! @returns bytes put in since the file was opened or rotated to.
+   uint64_t tell() const { return pos_; }
+
+   void append( const void* p, size_t n );
+   void append( const Buffer& b );
+
+   //! @returns false once the file could not be opened or written.
+   bool good() const { return thread_ && ! failed_; }
+
+private:
+   BlockWriter( const BlockWriter& );
+   BlockWriter& operator=( const BlockWriter& );
+
+   //! What the flusher is to do: write a block or a message by reference,
+   //! or move on to another file.
+   struct Entry {
+      char* block;      //!< staging block, NULL for a message
+      size_t len;       //!< bytes of block in use
+      BufferPtr msg;    //!< the message otherwise
+      int fd;           //!< the file to move on to, -1 if not that
+   };
+
+   static int create( const std::string& path, uint64_t prealloc );
+   void push();
+   void queue( const Entry& e );
+   char* take();
+   void flush();
+   void flushStaged();
+   void write( std::vector<iovec>& iov );
+   bool writeAll( std::vector<iovec>& iov );
+   void finish();
+
+   int fd_;                         //!< file being written, the flusher's
+   uint64_t written_;               //!< bytes written to fd_
+   char* cur_;                      //!< block being filled, NULL if none
+   boost::atomic<size_t> used_;     //!< bytes of cur_ in use
+   uint64_t pos_;                   //!< bytes put in for the current file
+   std::vector<char*> blocks_;      //!< every block, to free them
+   std::vector<char*> free_;        //!< blocks ready to be filled
+   std::deque<Entry> full_;         //!< waiting for the flusher, in order
+   char* staged_;                   //!< cur_, as the flusher is to see it
+   char* partial_;                  //!< block partly written, the flusher's
+   size_t partialLen_;              //!< bytes of partial_ written
+   boost::mutex mutex_;             //!< guards free_, full_, staged_, done_
+   boost::condition_variable work_; //!< wakes the flusher
+   boost::condition_variable freed_;  //!< wakes take()
+   bool done_;                      //!< no more entries are coming
+   boost::atomic<bool> failed_;     //!< a write failed, the rest is dropped
+   boost::scoped_ptr<boost::thread> thread_;
+};
+
+} // end namespace ntee
+
+#endif
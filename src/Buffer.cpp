@@ -1,16 +1,20 @@
+
 #include "Buffer.hpp"
+#include "BufferPool.hpp"
 
 namespace ntee {
 
 Buffer::Buffer(bool dyn)
- : len(0), buf(0), dyn_(dyn)
+ : type(L_to_R), len(0), session(0), buf(0), dyn_(dyn),
+   block_(0), capacity_(0), pool_(0), next_(0), refs_(0)
 {
    setTime();
 }
 
 
 Buffer::Buffer(const TransferType& tt, bool dyn) 
- : type(tt), len(0), buf(0), dyn_(dyn)
+ : type(tt), len(0), session(0), buf(0), dyn_(dyn),
+   block_(0), capacity_(0), pool_(0), next_(0), refs_(0)
 {
    setTime();
 }
@@ -19,7 +23,7 @@ Buffer::Buffer(const TransferType& tt, bool dyn)
 Buffer::~Buffer()
 {
    if ( dyn_ && buf )
-      delete buf;
+      free( (void*) buf );
 }
 
 
@@ -27,6 +31,70 @@ void Buffer::setTime()
 {
    clock_gettime(CLOCK_MONOTONIC, &ts );
 }
+
+
+//! @returns the time in nsec since the time stamp was taken.
+uint64_t Buffer::age() const
+{
+   timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now );
+   return (now.tv_sec - ts.tv_sec) * 1000000000ULL + now.tv_nsec - ts.tv_nsec;
+}
+
+
+//! @returns the number of bytes in this segment and all the segments
+//!          chained after it.
+size_t Buffer::size() const
+{
+   size_t total = 0;
+   for( const Buffer* p = this; p; p = p->next.get() )
+      total += p->len;
+   return total;
+}
+
+
+//! @brief Describes the segment chain as an iovec array.
+//!
+//! Gives a scatter/gather view of the message for writev() and friends.
+//! Empty segments are skipped.
+//!
+//! @param iov   Array to fill in.
+//! @param max   Number of entries in iov.
+//! @returns the number of entries filled in.  If the chain has more than
+//!          max segments only the first max are described.
+int Buffer::gather( iovec* iov, int max ) const
+{
+   int n = 0;
+   for( const Buffer* p = this; p && n < max; p = p->next.get() ) {
+      if ( p->len > 0 ) {
+         iov[n].iov_base = const_cast<char*>( p->buf );
+         iov[n].iov_len = p->len;
+         ++n;
+      }
+   }
+   return n;
+}
+
+
+//! Takes a reference on a Buffer, used by BufferPtr.
+void intrusive_ptr_add_ref( const Buffer* b )
+{
+   b->refs_.fetch_add( 1, boost::memory_order_relaxed );
+}
+
+
+//! Drops a reference on a Buffer, used by BufferPtr.  When the last one
+//! goes a pooled Buffer returns to its pool, any other Buffer is deleted.
+void intrusive_ptr_release( const Buffer* b )
+{
+   if ( b->refs_.fetch_sub( 1, boost::memory_order_acq_rel ) == 1 ) {
+      Buffer* pB = const_cast<Buffer*>( b );
+      if ( pB->pool_ )
+         pB->pool_->release( pB );
+      else
+         delete pB;
+   }
+}
    
 
 } // end namespace ntee
@@ -3,9 +3,22 @@
 
 #include <time.h>
 #include <cstdlib>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 namespace ntee {
 
+class BufferPool;
+struct Buffer;
+
+//! Reference counted handle on a Buffer.
+typedef boost::intrusive_ptr<Buffer> BufferPtr;
+
+void intrusive_ptr_add_ref( const Buffer* );
+void intrusive_ptr_release( const Buffer* );
+
 //! Describes the type of transfer direction.
 enum TransferType {
    L_to_R,    //!< Server to Client
@@ -15,26 +28,65 @@ enum TransferType {
 
 //! @brief A common data flow buffer.
 //! Encapsulates one message from one direction to another and records the
-//! time of the transfer.  The destructor of a Buffer will call delete on
+//! time of the transfer.  The destructor of a Buffer will call free on
 //! any buf available --so make sure you assign buffers which have been 
-//! dynamically allocated.
+//! dynamically allocated with malloc, or construct with dyn=false.
+//!
+//! Buffers handed around between the sockets, the relay and the recorders
+//! are reference counted through a BufferPtr.  Most of them come from the
+//! BufferPool, in which case buf points into a fixed size pool block and
+//! the Buffer goes back to the pool when the last reference is dropped.
+//!
+//! A message bigger than one block is a chain of segments linked through
+//! next.  The first segment carries the type, time and session of the
+//! whole message; len is always the length of the one segment, size() is
+//! the length of the message.
 struct Buffer {
    
    Buffer(bool dyn=true);
    Buffer(const TransferType& tt, bool dyn=true);
    ~Buffer();
    void setTime();
+   uint64_t age() const;
+   
+   //! @returns writable payload space of a pooled Buffer, NULL otherwise.
+   char* block() const { return block_; }
+   
+   //! @returns the size in bytes of block().
+   size_t capacity() const { return capacity_; }
+   
+   //! @returns true if some BufferPtr holds a reference to this Buffer, in
+   //!          which case more references may be taken instead of copying.
+   bool shared() const { return refs_.load() > 0; }
    
-   TransferType type;  //!< The type of buffer
-   ssize_t len;        //!< The length in bytes of the buf char array
-   timespec ts;        //!< The time the buffer was recorded
+   size_t size() const;
+   int gather( iovec* iov, int max ) const;
    
-   const char* buf;    //!< payload
-   bool dyn_;          //!< true if payload was dynamically allocated with malloc
+   TransferType type;     //!< The type of buffer
+   ssize_t len;           //!< The length in bytes of the buf char array
+   timespec ts;           //!< The time the buffer was recorded
+   unsigned int session;  //!< Id of the L/R session the buffer belongs to
+   
+   const char* buf;       //!< payload
+   bool dyn_;             //!< true if payload was dynamically allocated with malloc
+   BufferPtr next;        //!< next segment of the same message, if any
+   
+private:
+   Buffer( const Buffer& );
+   Buffer& operator=( const Buffer& );
+   
+   friend class BufferPool;
+   friend void intrusive_ptr_add_ref( const Buffer* );
+   friend void intrusive_ptr_release( const Buffer* );
+   
+   char* block_;                   //!< pool block, NULL if not pooled
+   size_t capacity_;               //!< size of block_
+   BufferPool* pool_;              //!< pool to return to, NULL if not pooled
+   Buffer* next_;                  //!< free list link while in the pool
+   mutable boost::atomic<int> refs_;  //!< number of BufferPtr references
 };
 
 
 } // end namespace ntee
 
 #endif
-
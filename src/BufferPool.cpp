@@ -0,0 +1,152 @@
+#include "BufferPool.hpp"
+#include <cstring>
+#include <boost/thread/locks.hpp>
+
+namespace ntee {
+
+//! @brief The process wide pool.
+//!
+//! Created on first use so that it exists before any static object which
+//! might want a Buffer, and torn down after them.
+BufferPool& BufferPool::instance()
+{
+   static BufferPool pool;
+   return pool;
+}
+
+
+//! Creates an empty pool, slabs are added on demand.
+BufferPool::BufferPool()
+ : free_(0), available_(0)
+{
+   // empty
+}
+
+
+//! Returns the slab memory.  Any Buffer still referenced is left dangling,
+//! which can only happen at process exit.
+BufferPool::~BufferPool()
+{
+   for( size_t i=0; i < buffers_.size(); ++i ) {
+      delete [] buffers_[i];
+      delete [] blocks_[i];
+   }
+}
+
+
+//! @brief Hands out a Buffer with room for len bytes.
+//!
+//! The Buffer's buf points at its block(), len and session are zero, type
+//! is L_to_R and the time stamp is taken now.  Requests larger than
+//! BLOCK_SIZE can't be pooled, they get a one-off Buffer with malloc'd
+//! space instead.
+//!
+//! @param len   Number of bytes the caller needs to put in the Buffer.
+//! @returns a reference to the Buffer.
+BufferPtr BufferPool::acquire( size_t len )
+{
+   if ( len > BLOCK_SIZE ) {
+      Buffer* b = new Buffer();
+      b->block_ = (char*) malloc( len );
+      if ( b->block_ == 0 ) {
+         delete b;
+         throw std::bad_alloc();
+      }
+      b->buf = b->block_;
+      b->capacity_ = len;
+      return BufferPtr( b );
+   }
+   
+   Buffer* b;
+   {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      if ( free_ == 0 )
+         grow();
+      b = free_;
+      free_ = b->next_;
+      --available_;
+   }
+   b->next_ = 0;
+   b->type = L_to_R;
+   b->len = 0;
+   b->session = 0;
+   b->buf = b->block_;
+   b->setTime();
+   return BufferPtr( b );
+}
+
+
+//! @brief Grows the pool to at least n slabs up front.
+//!
+//! Slabs are never given back, so memory reserved stays where it is for
+//! the life of the process; the io_uring engine relies on that when it
+//! registers them with the kernel.
+void BufferPool::reserve( size_t n )
+{
+   boost::lock_guard<boost::mutex> lock( mutex_ );
+   while( buffers_.size() < n )
+      grow();
+}
+
+
+//! @returns the payload memory of slab i, SLAB_BUFFERS * BLOCK_SIZE bytes
+//!          holding the blocks of its Buffers one after the other.
+char* BufferPool::slab( size_t i ) const
+{
+   boost::lock_guard<boost::mutex> lock( mutex_ );
+   return blocks_.at(i);
+}
+
+
+//! @returns the number of slabs allocated so far.
+size_t BufferPool::slabs() const
+{
+   boost::lock_guard<boost::mutex> lock( mutex_ );
+   return buffers_.size();
+}
+
+
+//! @returns the number of Buffers sitting on the free list.
+size_t BufferPool::available() const
+{
+   boost::lock_guard<boost::mutex> lock( mutex_ );
+   return available_;
+}
+
+
+//! Puts a Buffer back on the free list, called when its last reference
+//! was dropped.  The rest of its segment chain is let go of after the
+//! mutex is released, since that may well come back here.
+void BufferPool::release( Buffer* b )
+{
+   BufferPtr rest;
+   rest.swap( b->next );
+   
+   boost::lock_guard<boost::mutex> lock( mutex_ );
+   b->next_ = free_;
+   free_ = b;
+   ++available_;
+}
+
+
+//! Adds a slab to the pool.  Called with the mutex held.
+void BufferPool::grow()
+{
+   Buffer* bufs = new Buffer[SLAB_BUFFERS];
+   char* mem = new char[SLAB_BUFFERS * BLOCK_SIZE];
+   buffers_.push_back( bufs );
+   blocks_.push_back( mem );
+   
+   for( size_t i=0; i < SLAB_BUFFERS; ++i ) {
+      Buffer& b = bufs[i];
+      b.dyn_ = false;
+      b.block_ = mem + i*BLOCK_SIZE;
+      b.capacity_ = BLOCK_SIZE;
+      b.pool_ = this;
+      b.next_ = free_;
+      free_ = &b;
+   }
+   available_ += SLAB_BUFFERS;
+}
+
+} // end namespace ntee
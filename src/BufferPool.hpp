@@ -0,0 +1,55 @@
+#ifndef INCLUDED_BUFFERPOOL_HPP
+#define INCLUDED_BUFFERPOOL_HPP
+
+#include "Buffer.hpp"
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+namespace ntee {
+
+//! @brief Slab allocator of fixed size, reference counted Buffers.
+//!
+//! The pool carves slabs of memory into BLOCK_SIZE payload blocks, each
+//! married to a Buffer for its lifetime.  acquire() hands out a Buffer
+//! from the free list and the last BufferPtr to let go of it puts it back,
+//! from whichever thread that happens to be.  Slabs are only ever added,
+//! so once the pool has grown to the working set a message costs no calls
+//! to the allocator.  There is one pool per process, shared by the
+//! sockets, the relay, the recorders and the BinaryDataReader.
+class BufferPool {
+public:
+   //! Size in bytes of the payload block of every pooled Buffer.
+   static const size_t BLOCK_SIZE = 64*1024;
+   
+   //! Number of Buffers carved out of each slab.
+   static const size_t SLAB_BUFFERS = 64;
+   
+   static BufferPool& instance();
+   
+   BufferPtr acquire( size_t len = BLOCK_SIZE );
+   
+   void reserve( size_t n );
+   char* slab( size_t i ) const;
+   size_t slabs() const;
+   size_t available() const;
+   
+private:
+   BufferPool();
+   ~BufferPool();
+   BufferPool( const BufferPool& );
+   BufferPool& operator=( const BufferPool& );
+   
+   friend void intrusive_ptr_release( const Buffer* );
+   void release( Buffer* b );
+   void grow();
+   
+   mutable boost::mutex mutex_;   //!< guards everything below
+   Buffer* free_;                 //!< free list, linked through Buffer::next_
+   size_t available_;             //!< length of the free list
+   std::vector<Buffer*> buffers_; //!< Buffer array of each slab
+   std::vector<char*> blocks_;    //!< payload memory of each slab
+};
+
+} // end namespace ntee
+
+#endif
@@ -0,0 +1,291 @@
+#include "DatagramRelay.hpp"
+#include "NTee.hpp"
+#include "Settings.hpp"
+#include "EventLoop.hpp"
+#include "IPAddress.hpp"
+#include "Error.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <iostream>
+#include <boost/bind.hpp>
+
+namespace ntee {
+
+const unsigned DatagramRelay::PEER_IDLE_SECS;
+
+//! @brief Creates a relay serving the R side from a bound service socket.
+//!
+//! @param owner  The NTee instance whose recorders get a copy of the data.
+//! @param svc    Dynamically allocated, bound UDP service socket.  The
+//!               relay takes ownership.
+DatagramRelay::DatagramRelay( NTee& owner, UDPSocket* svc )
+ : owner_(owner), svc_(svc), loop_(0), timer_(-1)
+{
+   // empty
+}
+
+
+//! Detaches every socket from the loop and closes them.
+DatagramRelay::~DatagramRelay()
+{
+   PeerMap_t::iterator iter = peers_.begin();
+   for( ; iter != peers_.end(); ++iter ) {
+      if ( loop_ )
+         loop_->remove( iter->second->L->getFD() );
+      iter->second->L->close();
+   }
+   if ( timer_ != -1 ) {
+      if ( loop_ )
+         loop_->remove( timer_ );
+      ::close( timer_ );
+   }
+   if ( loop_ )
+      loop_->remove( svc_->getFD() );
+   svc_->close();
+}
+
+
+//! @brief Registers the service socket with an EventLoop, and in
+//!        multi-session the timer which ends idle sessions.
+//!
+//! A session is ended after one to two PEER_IDLE_SECS without datagrams,
+//! as the timer only looks every PEER_IDLE_SECS.
+//!
+//! @returns 0 on success, -1 with errno set if the loop refused it.
+int DatagramRelay::attach( EventLoop& loop )
+{
+   fcntl(svc_->getFD(), F_SETFL, O_NONBLOCK);
+   if ( loop.add( svc_->getFD(), EPOLLIN, 
+                  boost::bind(&DatagramRelay::fromR, this, _1) ) == -1 )
+      return -1;
+   loop_ = &loop;
+   if ( ! owner_.s_.multi_session )
+      return 0;
+
+   timer_ = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+   if ( timer_ == -1 )
+      return -1;
+   itimerspec its;
+   memset( &its, 0, sizeof(its) );
+   its.it_value.tv_sec = its.it_interval.tv_sec = PEER_IDLE_SECS;
+   if ( timerfd_settime( timer_, 0, &its, 0 ) == -1
+        || loop.add( timer_, EPOLLIN, 
+                     boost::bind(&DatagramRelay::sweep, this, _1) ) == -1 )
+      return -1;
+   return 0;
+}
+
+
+//! @brief Sums the counters of one direction.
+//!
+//! The reads of the service socket, and the datagrams from R addresses
+//! which aren't served, belong to no session and are only counted here.
+//!
+//! @param dir   L_to_R or R_to_L.
+//! @returns the counters of all the sessions in direction dir.
+RelayStats DatagramRelay::stats( TransferType dir ) const
+{
+   RelayStats sum = stats_[dir];
+   PeerMap_t::const_iterator iter = peers_.begin();
+   for( ; iter != peers_.end(); ++iter )
+      sum += iter->second->stats[dir];
+   return sum;
+}
+
+
+//! @brief Lists the counters of every session.
+//! @param out   One entry per session is appended to it.
+void DatagramRelay::sessions( std::vector<SessionStats>& out ) const
+{
+   PeerMap_t::const_iterator iter = peers_.begin();
+   for( ; iter != peers_.end(); ++iter ) {
+      SessionStats ss;
+      ss.id = iter->second->id;
+      ss.dir[L_to_R] = &iter->second->stats[L_to_R];
+      ss.dir[R_to_L] = &iter->second->stats[R_to_L];
+      out.push_back( ss );
+   }
+}
+
+
+//! @brief Moves datagrams from the R side peers to the L side.
+//!
+//! The socket is edge-triggered, so batches are read until there is
+//! nothing left.  Runs of datagrams within a batch from the same peer are
+//! sent on with a single call.
+//!
+//! @param events  epoll event mask that fired.
+void DatagramRelay::fromR( uint32_t events )
+{
+   BufferPtr bufs[UDPSocket::BATCH];
+   sockaddr_storage from[UDPSocket::BATCH];
+   socklen_t fromlen[UDPSocket::BATCH];
+   
+   IoCount& io = stats_[R_to_L].reads;
+   for( ;; ) {
+      int n = svc_->recvBatch( bufs, from, fromlen, UDPSocket::BATCH );
+      ++io.calls;
+      if ( n == 0 )
+         ++io.again;
+      if ( n <= 0 )
+         break;
+      
+      for( int i=0, j; i < n; i=j ) {
+         for( j=i+1; j < n && fromlen[j] == fromlen[i] 
+                     && ! memcmp( &from[j], &from[i], fromlen[i] ); ++j ) {
+            /* same peer */
+         }
+         Peer* p = findPeer( from[i], fromlen[i] );
+         if ( p )
+            forward( *p->L, &bufs[i], j-i, 0, 0, R_to_L, p );
+         else
+            stats_[R_to_L].dropped += j-i;
+      }
+      
+      if ( n < UDPSocket::BATCH )
+         break;      // drained
+   }
+}
+
+
+//! @brief Moves datagrams from the L side back to the peer they are for.
+//!
+//! @param p       The session whose L socket is readable.
+//! @param events  epoll event mask that fired.
+void DatagramRelay::fromL( Peer* p, uint32_t events )
+{
+   BufferPtr bufs[UDPSocket::BATCH];
+   
+   IoCount& io = p->stats[L_to_R].reads;
+   for( ;; ) {
+      int n = p->L->recvBatch( bufs, 0, 0, UDPSocket::BATCH );
+      ++io.calls;
+      if ( n == -1 && errno == ECONNREFUSED )
+         continue;   // an earlier datagram found nobody home on L
+      if ( n == 0 )
+         ++io.again;
+      if ( n <= 0 )
+         break;
+      
+      forward( *svc_, bufs, n, (const sockaddr*) &p->addr, p->len, 
+               L_to_R, p );
+      
+      if ( n < UDPSocket::BATCH )
+         break;      // drained
+   }
+}
+
+
+//! @brief Looks up the session of an R side address, making one if new.
+//!
+//! @returns the session, or NULL if the address isn't to be served or
+//!          the L side can't be reached.
+DatagramRelay::Peer* DatagramRelay::findPeer( const sockaddr_storage& addr,
+                                              socklen_t len )
+{
+   std::string key( (const char*) &addr, len );
+   PeerMap_t::iterator iter = peers_.find( key );
+   if ( iter != peers_.end() )
+      return iter->second.get();
+   if ( ! owner_.s_.multi_session && ! peers_.empty() )
+      return 0;
+   
+   const Settings& s = owner_.s_;
+   boost::shared_ptr<Peer> p( new Peer );
+   p->addr = addr;
+   p->len = len;
+   p->L.reset( new UDPSocket("L") );
+   IPAddress lip( s.L_host_ip.c_str(), s.L_port.c_str() );
+   if ( p->L->connectTo( lip ) == -1 ) {
+      WarnIf( true ).info("Unable to connect to L side %s:%s, dropping R\n",
+                          s.L_host_ip.c_str(), s.L_port.c_str());
+      p->L->close();
+      return 0;
+   }
+   fcntl(p->L->getFD(), F_SETFL, O_NONBLOCK);
+   if ( loop_->add( p->L->getFD(), EPOLLIN,
+                    boost::bind(&DatagramRelay::fromL, this, p.get(), _1) ) == -1 ) {
+      p->L->close();
+      return 0;
+   }
+   
+   p->id = owner_.nextId_++;
+   p->idle = false;
+   peers_[key] = p;
+   std::cout << "NTee session " << p->id << " connected to L side: " 
+             << s.L_host_ip << ":" << s.L_port << "\n";
+   return p.get();
+}
+
+
+//! @brief Ends the sessions which moved no datagrams since the last time.
+//!
+//! Their counters are kept in stats_, so the totals don't go back.
+//!
+//! @param events  epoll event mask that fired.
+void DatagramRelay::sweep( uint32_t events )
+{
+   uint64_t expired;
+   if ( ::read( timer_, &expired, sizeof(expired) ) != sizeof(expired) )
+      return;
+   PeerMap_t::iterator iter = peers_.begin();
+   while( iter != peers_.end() ) {
+      Peer& p = *iter->second;
+      if ( ! p.idle ) {
+         p.idle = true;
+         ++iter;
+         continue;
+      }
+      std::cout << "NTee session " << p.id << " ended, idle\n";
+      stats_[L_to_R] += p.stats[L_to_R];
+      stats_[R_to_L] += p.stats[R_to_L];
+      loop_->remove( p.L->getFD() );
+      p.L->close();
+      peers_.erase( iter++ );
+   }
+}
+
+
+//! @brief Sends a run of datagrams and records those which were sent.
+//!
+//! @param to     Socket to send on.
+//! @param bufs   The datagrams.
+//! @param n      Number of datagrams.
+//! @param addr   Where to send them, NULL if to is connected.
+//! @param len    Length of addr.
+//! @param dir    Direction, L_to_R or R_to_L.
+//! @param p      Session the datagrams belong to.
+void DatagramRelay::forward( UDPSocket& to, BufferPtr* bufs, int n, 
+                             const sockaddr* addr, socklen_t len,
+                             TransferType dir, Peer* p )
+{
+   RelayStats& st = p->stats[dir];
+   p->idle = false;
+   int sent = 0;
+   while( sent < n ) {
+      int got = to.sendBatch( &bufs[sent], n-sent, addr, len );
+      ++st.writes.calls;
+      if ( got == -1 && errno == ECONNREFUSED )
+         continue;   // an earlier datagram found nobody home on L
+      if ( got == -1 && errno == EAGAIN )
+         ++st.writes.again;
+      if ( got <= 0 )
+         break;
+      sent += got;
+   }
+   st.dropped += n - sent;
+   
+   // The datagrams which didn't go out were dropped, and aren't recorded
+   for( int i=0; i < sent; ++i ) {
+      st.bytes += bufs[i]->size();
+      st.latency.record( bufs[i]->age() );
+      bufs[i]->type = dir;
+      bufs[i]->session = p->id;
+      owner_.alertRecorders( *bufs[i] );
+   }
+}
+
+} // end namespace ntee
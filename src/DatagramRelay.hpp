@@ -0,0 +1,82 @@
+#ifndef INCLUDED_DATAGRAMRELAY_HPP
+#define INCLUDED_DATAGRAMRELAY_HPP
+
+#include "Relay.hpp"
+#include "UDPSocket.hpp"
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace ntee {
+
+class NTee;
+class EventLoop;
+
+//! @brief Relays datagrams between R side peers and the L side.
+//!
+//! UDP has no connections to accept, so the R side clients all send to
+//! the one service socket.  Each new R address seen becomes a session
+//! with its own socket connected to the L side; what L sends back on that
+//! socket is returned to the R address it belongs to.  Without
+//! multi-session only the first R address is served, datagrams from any
+//! other are dropped.  With it, a session which has moved no datagrams
+//! either way for PEER_IDLE_SECS is ended and its socket closed, since
+//! there is no close to tell it by.
+//!
+//! Datagrams are moved in batches of up to UDPSocket::BATCH with
+//! recvmmsg()/sendmmsg(), and every datagram is recorded as a record of
+//! its own.  Nothing is queued: a datagram the receiving socket has no
+//! room for is dropped and counted, as the network would.
+class DatagramRelay {
+public:
+   //! Seconds a session in multi-session may go without datagrams.
+   static const unsigned PEER_IDLE_SECS = 60;
+
+   DatagramRelay( NTee& owner, UDPSocket* svc );
+   ~DatagramRelay();
+
+   int attach( EventLoop& loop );
+
+   RelayStats stats( TransferType dir ) const;
+   void sessions( std::vector<SessionStats>& out ) const;
+
+private:
+   DatagramRelay( const DatagramRelay& );
+   DatagramRelay& operator=( const DatagramRelay& );
+
+   //! An R side address and the socket its datagrams go to L through.
+   struct Peer {
+      unsigned int id;                 //!< session number
+      sockaddr_storage addr;           //!< the R side address
+      socklen_t len;                   //!< length of addr
+      boost::scoped_ptr<UDPSocket> L;  //!< connected to the L side
+      RelayStats stats[2];             //!< counters, by TransferType
+      bool idle;                       //!< nothing moved since the last sweep
+   };
+
+   typedef std::map<std::string, boost::shared_ptr<Peer> > PeerMap_t;
+
+   void fromR( uint32_t events );
+   void fromL( Peer* p, uint32_t events );
+   Peer* findPeer( const sockaddr_storage& addr, socklen_t len );
+   void sweep( uint32_t events );
+   void forward( UDPSocket& to, BufferPtr* bufs, int n, 
+                 const sockaddr* addr, socklen_t len,
+                 TransferType dir, Peer* p );
+
+   NTee& owner_;                     //!< settings, recorders and session ids
+   boost::scoped_ptr<UDPSocket> svc_;  //!< where the R side sends to
+   PeerMap_t peers_;                 //!< sessions, by raw R address
+   EventLoop* loop_;                 //!< loop we are attached to, if any
+   int timer_;                       //!< timerfd which ends idle sessions, or -1
+   RelayStats stats_[2];             //!< counters of no session, or of ended
+                                     //!< ones, by TransferType
+};
+
+} // end namespace ntee
+
+#endif
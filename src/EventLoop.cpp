@@ -0,0 +1,162 @@
+#include "EventLoop.hpp"
+#include "Error.hpp"
+#include <errno.h>
+#include <unistd.h>
+
+namespace ntee {
+
+//! Maximum number of events collected from the kernel per epoll_wait().
+static const int MAX_EVENTS = 64;
+
+
+//! @brief Creates the epoll instance.
+//!
+//! The epoll descriptor is created with EPOLL_CLOEXEC so that it does not
+//! leak into the R side child process.
+EventLoop::EventLoop()
+ : epfd_(-1), stop_(0)
+{
+   SysErrIf( (epfd_=epoll_create1(EPOLL_CLOEXEC)) == -1 );
+}
+
+
+//! Closes the epoll instance and frees any registration entries.  The
+//! registered descriptors themselves are NOT closed.
+EventLoop::~EventLoop()
+{
+   EntryMap_t::iterator iter = entries_.begin();
+   for( ; iter != entries_.end(); ++iter )
+      delete iter->second;
+   for( size_t i=0; i < graveyard_.size(); ++i )
+      delete graveyard_[i];
+   ::close(epfd_);
+}
+
+
+//! @brief Registers a descriptor with the loop.
+//!
+//! @param fd      The descriptor to watch.  It should already be non-blocking.
+//! @param events  epoll event mask (EPOLLIN, EPOLLOUT, ...).  EPOLLET is
+//!                always added.
+//! @param h       Handler called with the fired event mask.
+//!
+//! @returns the return value of epoll_ctl(), -1 with errno set on failure.
+int EventLoop::add( int fd, uint32_t events, const Handler_t& h )
+{
+   Entry* e = new Entry;
+   e->fd = fd;
+   e->live = true;
+   e->handler = h;
+
+   epoll_event ev;
+   ev.events = events | EPOLLET;
+   ev.data.ptr = e;
+   int rc = epoll_ctl( epfd_, EPOLL_CTL_ADD, fd, &ev );
+   if ( rc == -1 ) {
+      delete e;
+      return rc;
+   }
+   entries_[fd] = e;
+   return rc;
+}
+
+
+//! @brief Changes the event mask of an already registered descriptor.
+//! @returns the return value of epoll_ctl(), -1 if fd was never added.
+int EventLoop::modify( int fd, uint32_t events )
+{
+   EntryMap_t::iterator iter = entries_.find(fd);
+   if ( iter == entries_.end() )
+      return -1;
+
+   epoll_event ev;
+   ev.events = events | EPOLLET;
+   ev.data.ptr = iter->second;
+   return epoll_ctl( epfd_, EPOLL_CTL_MOD, fd, &ev );
+}
+
+
+//! @brief Stops watching a descriptor.
+//!
+//! Must be called BEFORE the descriptor is closed.  It is safe to call from
+//! inside a handler, even the descriptor's own; the entry is kept around
+//! until the current batch of events has been dispatched so that a later
+//! event in the same batch is simply ignored.
+//!
+//! @returns the return value of epoll_ctl(), -1 if fd was never added.
+int EventLoop::remove( int fd )
+{
+   EntryMap_t::iterator iter = entries_.find(fd);
+   if ( iter == entries_.end() )
+      return -1;
+
+   Entry* e = iter->second;
+   entries_.erase(iter);
+   e->live = false;
+   graveyard_.push_back(e);
+   return epoll_ctl( epfd_, EPOLL_CTL_DEL, fd, 0 );
+}
+
+
+//! @brief Dispatches events until stopped.
+//!
+//! Waits on the epoll instance and calls each ready descriptor's handler.
+//! Returns when stop() has been called or when no descriptors are left to
+//! watch.  EINTR (eg. a SIGCHLD from the R side process) simply causes
+//! another wait.
+//!
+//! @returns 0 when stopped normally.
+int EventLoop::run()
+{
+   epoll_event events[MAX_EVENTS];
+   stop_ = 0;
+
+   while( ! stop_ && ! entries_.empty() ) {
+      int n = epoll_wait( epfd_, events, MAX_EVENTS, -1 );
+      if ( n == -1 ) {
+         SysErrIf( errno != EINTR );
+         continue;
+      }
+
+      for( int i=0; i < n; ++i ) {
+         Entry* e = static_cast<Entry*>( events[i].data.ptr );
+         if ( e->live )
+            e->handler( events[i].events );
+      }
+
+      for( size_t i=0; i < graveyard_.size(); ++i )
+         delete graveyard_[i];
+      graveyard_.clear();
+
+      // What these defer in turn waits for the next batch.
+      std::vector<boost::function<void ()> > todo;
+      todo.swap( deferred_ );
+      for( size_t i=0; i < todo.size(); ++i )
+         todo[i]();
+   }
+   return 0;
+}
+
+
+//! @brief Asks the loop to return from run().
+//!
+//! Only sets a flag, so it may be called from a handler or a signal handler.
+//! The loop notices the flag after the current batch of events, or when a
+//! signal interrupts epoll_wait().
+void EventLoop::stop()
+{
+   stop_ = 1;
+}
+
+
+//! @brief Has f called once the current batch of events has been
+//!        dispatched.
+//!
+//! Lets a handler leave the freeing of what it, or the object it belongs
+//! to, is still running in until no handler is running any more.
+void EventLoop::defer( const boost::function<void ()>& f )
+{
+   deferred_.push_back( f );
+}
+
+} // end namespace ntee
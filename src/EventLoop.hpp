@@ -0,0 +1,62 @@
+#ifndef INCLUDED_EVENTLOOP_HPP
+#define INCLUDED_EVENTLOOP_HPP
+
+#include <map>
+#include <vector>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <boost/function.hpp>
+
+namespace ntee {
+
+//! @brief An epoll driven reactor.
+//!
+//! The EventLoop owns a single epoll instance.  Clients register a file
+//! descriptor together with a handler, and the loop calls the handler back
+//! with the epoll event mask whenever the descriptor becomes ready.  All
+//! descriptors are registered edge-triggered (EPOLLET), so handlers must
+//! drain a descriptor until EAGAIN before returning.
+class EventLoop {
+public:
+   //! Callback type.  The argument is the mask of epoll events that fired.
+   typedef boost::function<void (uint32_t)> Handler_t;
+
+   EventLoop();
+   ~EventLoop();
+
+   int add( int fd, uint32_t events, const Handler_t& h );
+   int modify( int fd, uint32_t events );
+   int remove( int fd );
+
+   int run();
+   void stop();
+   void defer( const boost::function<void ()>& f );
+
+   //! @returns the number of descriptors currently registered.
+   size_t size() const { return entries_.size(); }
+
+private:
+   EventLoop( const EventLoop& );
+   EventLoop& operator=( const EventLoop& );
+
+   //! One of these is kept for each registered descriptor, its address is
+   //! handed to the kernel as the epoll_event data pointer.
+   struct Entry {
+      int fd;              //!< the registered descriptor
+      bool live;           //!< false once remove() was called on it
+      Handler_t handler;   //!< who to call back
+   };
+
+   typedef std::map<int, Entry*> EntryMap_t;
+
+   int epfd_;                       //!< the epoll instance
+   EntryMap_t entries_;             //!< registered descriptors, by fd
+   std::vector<Entry*> graveyard_;  //!< removed entries, freed after dispatch
+   std::vector<boost::function<void ()> > deferred_;  //!< run after dispatch
+   volatile sig_atomic_t stop_;     //!< set by stop(), safe from a signal
+};
+
+} // end namespace ntee
+
+#endif
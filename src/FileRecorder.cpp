@@ -1,9 +1,9 @@
 #include "FileRecorder.hpp"
 #include "Settings.hpp"
 #include "Error.hpp"
-#include <time.h>    // for clock_gettime() high precision
-#include <fstream>
-#include <iomanip>
+#include "HexDump.hpp"
+#include <string.h>
+#include <algorithm>
 
  
 namespace ntee {
@@ -11,12 +11,23 @@ namespace ntee {
 //! @brief Constructs the FileRecorder
 //!
 //! Opens the file descriptor.  If the file can't be opened the program is terminated.
+//! With a segment size or age set, the output is split into segments and
+//! the file becomes their manifest; see SegmentSet.
 //!
 FileRecorder::FileRecorder( const Settings& s )
 {
-   /* Test the output stream? How do we handle a bad input? */
-   out_.open(s.output_filename.c_str(), std::ios_base::out|std::ios_base::trunc);
-   ErrIf( out_.fail() ).info("FileRecorder unable to open: %s\n",s.output_filename.c_str());
+   std::string path = s.output_filename;
+   if ( s.segment_bytes || s.segment_secs ) {
+      ErrIf( segs_.open( path, s.segment_bytes, s.segment_secs ) == -1 )
+         .info("FileRecorder unable to open: %s\n",path.c_str());
+      path = segs_.path();
+   }
+   ErrIf( out_.open(path, segs_.maxBytes()) == -1 ).info("FileRecorder unable to open: %s\n",path.c_str());
+   if ( segs_.enabled() ) {
+      timespec now;
+      clock_gettime( CLOCK_MONOTONIC, &now );
+      segs_.opened( now );
+   }
 }
 
 
@@ -27,6 +38,7 @@ FileRecorder::FileRecorder( const Settings& s )
 void FileRecorder::shutdown()
 {
    out_.close();
+   segs_.close();
 }
 
 
@@ -35,42 +47,88 @@ void FileRecorder::shutdown()
 //! Virtual function implementation of the Recorder::record interface. This
 //! will write the message in a human readable format to the output file.
 //!
-void FileRecorder::record( const Socket& from, const Socket& to, 
-                           const char* buf, size_t len )
+void FileRecorder::record( const Buffer& b )
 {
-   header(from,to);
-   body(buf, len);
+   if ( segs_.due( out_.tell(), b.ts ) )
+      roll( b.ts );
+   header(b);
+   body(b);
 }
 
 
-void FileRecorder::header( const Socket& from, const Socket& to )
+//! The time written is when the message was read by the relay, not when
+//! it gets written here.
+void FileRecorder::header( const Buffer& b )
 {
-   timespec ts;
-   clock_gettime(CLOCK_MONOTONIC, &ts);
-   out_ << std::dec << ts.tv_sec << ":" << ts.tv_nsec << "  from: " 
-        << from.name() << " to: " << to.name() << "\n";
+   static const char SESSION[] = "  session: ";
+   static const char FROM_L[] = "  from: L to: R\n";
+   static const char FROM_R[] = "  from: R to: L\n";
+
+   char* start = out_.room( 3*20 + 2*sizeof(SESSION) + sizeof(FROM_L) );
+   char* p = HexDump::decimal( start, b.ts.tv_sec );
+   *p++ = ':';
+   p = HexDump::decimal( p, b.ts.tv_nsec );
+   memcpy( p, SESSION, sizeof(SESSION)-1 );
+   p = HexDump::decimal( p + sizeof(SESSION)-1, b.session );
+   const char* from = (b.type == L_to_R)?FROM_L:FROM_R;
+   memcpy( p, from, sizeof(FROM_L)-1 );
+   out_.commit( p + sizeof(FROM_L)-1 - start );
 }
 
-void FileRecorder::body( const char* buf, size_t len )
+//! Writes the hex dump of a message, 16 bytes to a line in groups of two,
+//! with the offset at the front of each line.  The offsets run on across
+//! the segments of the message, so a line which straddles two segments is
+//! put together first.  The dump is followed by an empty line.
+void FileRecorder::body( const Buffer& b )
 {
-   using std::hex;
-   using std::setw;
-   using std::setfill;
-   
-   const unsigned char* p = (const unsigned char*) buf;
-   size_t at = 0;
-   while( at < len ) {
-      out_ << setw(8) << setfill('0') << hex << at;
-      for( int c=0; at<len && c<8; ++c ) {
-         out_ << " ";
-         for( int j=0; at<len && j<2; ++j ) {
-            out_ << setw(2) << setfill('0') << hex << (int) *p++;
-            ++at;
+   unsigned char part[16];
+   size_t fill = 0;
+   uint64_t at = 0;
+   for( const Buffer* seg = &b; seg; seg = seg->next.get() ) {
+      const unsigned char* p = (const unsigned char*) seg->buf;
+      const unsigned char* end = p + seg->len;
+      while( p < end ) {
+         if ( fill == 0 && end - p >= 16 ) {
+            line( p, at, 16 );
+            p += 16;
+            at += 16;
+            continue;
+         }
+         size_t n = std::min( (size_t) (end - p), 16 - fill );
+         memcpy( part + fill, p, n );
+         fill += n;
+         p += n;
+         if ( fill == 16 ) {
+            line( part, at, 16 );
+            at += 16;
+            fill = 0;
          }
       }
-      out_ << "\n";
    }
-   out_ << "\n";
+   if ( fill > 0 )
+      line( part, at, fill );
+   *out_.room( 1 ) = '\n';
+   out_.commit( 1 );
+}
+
+//! Writes one line of the hex dump to the output.
+void FileRecorder::line( const unsigned char* p, uint64_t at, size_t n )
+{
+   char* start = out_.room( HexDump::MAX_LINE );
+   out_.commit( HexDump::line( start, at, p, n ) - start );
+}
+
+
+//! Moves on to the next segment, or gives up segmenting if it can't be
+//! opened.
+void FileRecorder::roll( const timespec& now )
+{
+   std::string path = segs_.path();
+   if ( out_.rotate( path, segs_.maxBytes() ) == -1 ) {
+      segs_.failed();
+      return;
+   }
+   segs_.opened( now );
 }
 
 } // end namespace ntee
@@ -2,10 +2,8 @@
 #define INCLUDED_FILERECORDER_HPP
 
 #include "NTee.hpp"
-#include <fstream>
-
-// forward decl. but Socket is not in ntee namespace!
-class Socket;
+#include "BlockWriter.hpp"
+#include "SegmentSet.hpp"
 
 namespace ntee {
 
@@ -14,14 +12,17 @@ class Settings;
 class FileRecorder : public Recorder {
 public:
    explicit FileRecorder( const Settings& );
-   virtual void record( const Socket&, const Socket&, const char*, size_t );
+   virtual void record( const Buffer& );
    virtual void shutdown();
    
 private:
-   void header( const Socket&, const Socket& );
-   void body( const char*, size_t );
+   void header( const Buffer& );
+   void body( const Buffer& );
+   void line( const unsigned char* p, uint64_t at, size_t n );
+   void roll( const timespec& now );
    
-   std::ofstream out_;
+   BlockWriter out_;      //!< the records are formatted straight into it
+   SegmentSet segs_;      //!< the segments, when the recording is split
 };
 
 } // end namespace ntee
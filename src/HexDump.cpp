@@ -0,0 +1,134 @@
+#include "HexDump.hpp"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define NTEE_HEX_SSSE3
+#endif
+
+namespace ntee {
+
+const size_t HexDump::MAX_LINE;
+
+static const char DIGITS[] = "0123456789abcdef";
+
+//! Both hex digits of every byte value, "00" to "ff".
+static struct Table {
+   char pair[256][2];
+   Table() {
+      for( int i=0; i < 256; ++i ) {
+         pair[i][0] = DIGITS[i >> 4];
+         pair[i][1] = DIGITS[i & 0xf];
+      }
+   }
+} table;
+
+
+//! @brief Formats 16 bytes as the 8 groups of a full line.
+//! @returns the end of the 40 characters written.
+static char* groups( char* out, const unsigned char* p )
+{
+   for( int i=0; i < 16; i += 2 ) {
+      *out++ = ' ';
+      memcpy( out, table.pair[p[i]], 2 );
+      memcpy( out+2, table.pair[p[i+1]], 2 );
+      out += 4;
+   }
+   return out;
+}
+
+
+#ifdef NTEE_HEX_SSSE3
+//! @brief groups(), with the nibbles turned into digits by a shuffle and
+//!        the spaces put in by another.
+__attribute__((target("ssse3")))
+static char* groupsSSSE3( char* out, const unsigned char* p )
+{
+   const __m128i digits = _mm_loadu_si128( (const __m128i*) DIGITS );
+   const __m128i nibble = _mm_set1_epi8( 0x0f );
+   // " xxxx xxxx xxxx " from the first 12 digits, -1 picks a zero.
+   const __m128i spread = _mm_setr_epi8( -1, 0, 1, 2, 3, -1, 4, 5, 6, 7,
+                                         -1, 8, 9, 10, 11, -1 );
+   const __m128i spaces = _mm_setr_epi8( ' ', 0, 0, 0, 0, ' ', 0, 0, 0, 0,
+                                         ' ', 0, 0, 0, 0, ' ' );
+
+   __m128i v = _mm_loadu_si128( (const __m128i*) p );
+   __m128i hi = _mm_shuffle_epi8( digits, 
+                   _mm_and_si128( _mm_srli_epi16( v, 4 ), nibble ) );
+   __m128i lo = _mm_shuffle_epi8( digits, _mm_and_si128( v, nibble ) );
+   __m128i half[2] = { _mm_unpacklo_epi8( hi, lo ),     // bytes 0-7
+                       _mm_unpackhi_epi8( hi, lo ) };   // bytes 8-15
+   for( int i=0; i < 2; ++i ) {
+      _mm_storeu_si128( (__m128i*) out, 
+         _mm_or_si128( _mm_shuffle_epi8( half[i], spread ), spaces ) );
+      int last = _mm_cvtsi128_si32( _mm_srli_si128( half[i], 12 ) );
+      memcpy( out+16, &last, 4 );
+      out += 20;
+   }
+   return out;
+}
+#endif
+
+
+//! The full line formatter this CPU is best served by.
+typedef char* (*Groups_t)( char*, const unsigned char* );
+static Groups_t pickGroups()
+{
+#ifdef NTEE_HEX_SSSE3
+   if ( __builtin_cpu_supports( "ssse3" ) )
+      return groupsSSSE3;
+#endif
+   return groups;
+}
+static const Groups_t fullLine = pickGroups();
+
+
+//! @brief Formats one line of the dump.
+//!
+//! @param out     Where to write, with room for MAX_LINE characters.
+//! @param offset  Offset of the first byte within the message.  A
+//!                multiple of 16, which keeps the groups on even offsets.
+//! @param p       The bytes.
+//! @param n       Number of bytes, 1 to 16.
+//! @returns the end of what was written.
+char* HexDump::line( char* out, uint64_t offset, 
+                     const unsigned char* p, size_t n )
+{
+   int digits = 8;
+   while( digits < 16 && (offset >> (4*digits)) != 0 )
+      ++digits;
+   for( int i=digits-1; i >= 0; --i )
+      *out++ = DIGITS[ (offset >> (4*i)) & 0xf ];
+
+   if ( n == 16 )
+      out = fullLine( out, p );
+   else {
+      for( size_t i=0; i < n; ++i ) {
+         if ( i % 2 == 0 )
+            *out++ = ' ';
+         memcpy( out, table.pair[p[i]], 2 );
+         out += 2;
+      }
+   }
+   *out++ = '\n';
+   return out;
+}
+
+
+//! @brief Formats a number in decimal.
+//! @param out   Where to write, with room for 20 characters.
+//! @param v     The number.
+//! @returns the end of what was written.
+char* HexDump::decimal( char* out, uint64_t v )
+{
+   char tmp[20];
+   char* t = tmp + sizeof(tmp);
+   do {
+      *--t = '0' + v % 10;
+      v /= 10;
+   } while( v != 0 );
+   size_t len = tmp + sizeof(tmp) - t;
+   memcpy( out, t, len );
+   return out + len;
+}
+
+} // end namespace ntee
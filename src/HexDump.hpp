@@ -0,0 +1,29 @@
+#ifndef INCLUDED_HEXDUMP_HPP
+#define INCLUDED_HEXDUMP_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace ntee {
+
+//! @brief Formats the lines of the FileRecorder's hex dump.
+//!
+//! A line is the offset in at least 8 hex digits, then up to 16 bytes as
+//! 2 hex digits each, with a space in front of every group of two bytes,
+//! and a newline: "00000010 4865 6c6c 6f2c 2077 6f72 6c64 210a 0000\n".
+//! Digits come out of a lookup table straight into the caller's buffer.
+//! A full line is converted with SSSE3 shuffles, 16 bytes at a time, when
+//! the CPU has them.
+class HexDump {
+public:
+   //! Most characters one line can take, offset of 16 digits included.
+   static const size_t MAX_LINE = 16 + 40 + 1;
+
+   static char* line( char* out, uint64_t offset, 
+                      const unsigned char* p, size_t n );
+   static char* decimal( char* out, uint64_t v );
+};
+
+} // end namespace ntee
+
+#endif
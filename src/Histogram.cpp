@@ -0,0 +1,93 @@
+#include "Histogram.hpp"
+#include <algorithm>
+#include <math.h>
+
+namespace ntee {
+
+const int Histogram::SUB_BITS;
+const uint64_t Histogram::MAX_VALUE;
+
+//! Values below this are their own bucket.
+static const uint64_t SUB_COUNT = 1ULL << Histogram::SUB_BITS;
+
+//! Buckets each power of two range above SUB_COUNT is split into.
+static const uint64_t HALF_COUNT = SUB_COUNT / 2;
+
+
+//! Creates an empty histogram.
+Histogram::Histogram()
+ : counts_( index( MAX_VALUE ) + 1 ), count_(0), sum_(0), max_(0)
+{
+   // empty
+}
+
+
+//! @brief Counts one value.
+//! @param v   The value, for instance a latency in nsec.
+void Histogram::record( uint64_t v )
+{
+   ++counts_[ index( std::min( v, MAX_VALUE ) ) ];
+   ++count_;
+   sum_ += v;
+   max_ = std::max( max_, v );
+}
+
+
+//! @brief Finds the value at or below which p percent of the values fall.
+//!
+//! @param p   Percentile, 0 to 100.
+//! @returns the highest value of the bucket the percentile falls in, or
+//!          max() if that is lower or the percentile falls in the bucket
+//!          of MAX_VALUE.  0 if nothing was recorded.
+uint64_t Histogram::percentile( double p ) const
+{
+   if ( count_ == 0 )
+      return 0;
+   uint64_t want = (uint64_t) ceil( p / 100.0 * count_ );
+   want = std::max( want, (uint64_t) 1 );
+
+   uint64_t seen = 0;
+   for( size_t i=0; i+1 < counts_.size(); ++i ) {
+      seen += counts_[i];
+      if ( seen >= want )
+         return std::min( highest(i), max_ );
+   }
+   return max_;
+}
+
+
+//! Adds the counts of another histogram into this one.
+Histogram& Histogram::operator+=( const Histogram& o )
+{
+   for( size_t i=0; i < counts_.size(); ++i )
+      counts_[i] += o.counts_[i];
+   count_ += o.count_;
+   sum_ += o.sum_;
+   max_ = std::max( max_, o.max_ );
+   return *this;
+}
+
+
+//! @returns the bucket counting value v.
+size_t Histogram::index( uint64_t v )
+{
+   if ( v < SUB_COUNT )
+      return v;
+   int msb = 63 - __builtin_clzll( v );
+   int shift = msb - (SUB_BITS - 1);            // 1 or more
+   uint64_t sub = v >> shift;                   // HALF_COUNT to SUB_COUNT-1
+   return SUB_COUNT + (shift - 1) * HALF_COUNT + (sub - HALF_COUNT);
+}
+
+
+//! @returns the highest value counted by bucket idx.
+uint64_t Histogram::highest( size_t idx )
+{
+   if ( idx < SUB_COUNT )
+      return idx;
+   int shift = (idx - SUB_COUNT) / HALF_COUNT + 1;
+   uint64_t sub = (idx - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+   return ((sub + 1) << shift) - 1;
+}
+
+} // end namespace ntee
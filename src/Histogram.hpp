@@ -0,0 +1,55 @@
+#ifndef INCLUDED_HISTOGRAM_HPP
+#define INCLUDED_HISTOGRAM_HPP
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+namespace ntee {
+
+//! @brief A log-linear histogram of non-negative integer values.
+//!
+//! Values below 2^SUB_BITS are counted exactly.  Above that, every power
+//! of two range is split into 2^(SUB_BITS-1) equal buckets, so a value is
+//! known to within 1 part in 64 however big it is, in the style of
+//! HdrHistogram.  Recording is a couple of shifts and an increment, and
+//! histograms of the same layout add together, so one can be kept per
+//! Relay and summed for a report.  Values above MAX_VALUE are counted as
+//! MAX_VALUE, although max() still tells the real largest value.
+class Histogram {
+public:
+   //! Number of bits of a value kept exactly.
+   static const int SUB_BITS = 7;
+
+   //! Largest value told apart from bigger ones, about 68s in nsec.
+   static const uint64_t MAX_VALUE = (1ULL << 36) - 1;
+
+   Histogram();
+
+   void record( uint64_t v );
+   uint64_t percentile( double p ) const;
+
+   //! @returns the number of values recorded.
+   uint64_t count() const { return count_; }
+
+   //! @returns the sum of the values recorded.
+   uint64_t sum() const { return sum_; }
+
+   //! @returns the largest value recorded, 0 if none.
+   uint64_t max() const { return max_; }
+
+   Histogram& operator+=( const Histogram& o );
+
+private:
+   static size_t index( uint64_t v );
+   static uint64_t highest( size_t idx );
+
+   std::vector<uint64_t> counts_;   //!< number of values in each bucket
+   uint64_t count_;                 //!< number of values in all buckets
+   uint64_t sum_;                   //!< total of the values recorded
+   uint64_t max_;                   //!< largest value recorded
+};
+
+} // end namespace ntee
+
+#endif
@@ -0,0 +1,228 @@
+#include "MetricsServer.hpp"
+#include "EventLoop.hpp"
+#include "Error.hpp"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace ntee {
+
+//! Most clients waiting to be answered at once, the rest are turned away.
+static const size_t MAX_CLIENTS = 64;
+
+//! Most bytes of a request read, a client which sends more is dropped.
+static const size_t MAX_REQUEST = 8192;
+
+//! Seconds between sweeps of the clients for ones which are too slow.
+static const time_t SWEEP_SECS = 1;
+
+//! Sweeps a client may be around for before it is dropped.
+static const unsigned MAX_TICKS = 5;
+
+
+//! @brief Tells whether enough of a request is in to answer it.
+//!
+//! An HTTP GET is whole at the blank line after its headers, anything else
+//! at the end of its first line.
+//!
+//! @param req  what has been read of the request so far.
+static bool requestDone( const std::string& req )
+{
+   if ( req.size() < 4 && req.compare( 0, req.size(), "GET ", req.size() ) == 0 )
+      return false;   // can't tell yet
+   if ( req.compare( 0, 4, "GET " ) == 0 )
+      return req.find( "\r\n\r\n" ) != std::string::npos
+             || req.find( "\n\n" ) != std::string::npos;
+   return req.find( '\n' ) != std::string::npos;
+}
+
+
+//! @brief Creates the listening socket.
+//!
+//! Anything left at path by an earlier run is removed first.  A socket
+//! which can't be made is reported and the server stays idle.
+//!
+//! @param path    Where to bind the socket in the file system.
+//! @param source  Called for the page each time a client is answered.
+MetricsServer::MetricsServer( const std::string& path, const Source_t& source )
+ : path_(path), source_(source), fd_(-1), timer_(-1), loop_(0)
+{
+   sockaddr_un addr;
+   memset( &addr, 0, sizeof(addr) );
+   addr.sun_family = AF_UNIX;
+   ErrIf( path_.size() >= sizeof(addr.sun_path) )
+      .info("Metrics socket path too long: %s\n", path_.c_str());
+   strcpy( addr.sun_path, path_.c_str() );
+
+   fd_ = socket( AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0 );
+   SysErrIf( fd_ == -1 ).info("Unable to make the metrics socket\n");
+   unlink( path_.c_str() );
+   SysErrIf( bind( fd_, (sockaddr*) &addr, sizeof(addr) ) == -1 )
+      .info("Unable to bind the metrics socket to %s\n", path_.c_str());
+   SysErrIf( listen( fd_, 16 ) == -1 );
+
+   timer_ = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+   SysErrIf( timer_ == -1 ).info("Unable to make the metrics timer\n");
+   itimerspec its;
+   memset( &its, 0, sizeof(its) );
+   its.it_value.tv_sec = its.it_interval.tv_sec = SWEEP_SECS;
+   SysErrIf( timerfd_settime( timer_, 0, &its, 0 ) == -1 );
+}
+
+
+//! Closes every connection and removes the socket from the file system.
+MetricsServer::~MetricsServer()
+{
+   while( ! clients_.empty() )
+      drop( clients_.begin()->first );
+   if ( timer_ != -1 ) {
+      if ( loop_ )
+         loop_->remove( timer_ );
+      ::close( timer_ );
+   }
+   if ( fd_ != -1 ) {
+      if ( loop_ )
+         loop_->remove( fd_ );
+      ::close( fd_ );
+      unlink( path_.c_str() );
+   }
+}
+
+
+//! @brief Registers the listening socket, and the timer, with an EventLoop.
+//! @returns 0 on success, -1 with errno set if the loop refused either.
+int MetricsServer::attach( EventLoop& loop )
+{
+   if ( loop.add( timer_, EPOLLIN,
+                  boost::bind(&MetricsServer::sweep, this, _1) ) == -1 )
+      return -1;
+   loop_ = &loop;
+   if ( loop.add( fd_, EPOLLIN,
+                  boost::bind(&MetricsServer::acceptClients, this, _1) ) == -1 )
+      return -1;
+   return 0;
+}
+
+
+//! @brief Accepts every pending client.
+//! @param events  epoll event mask that fired.
+void MetricsServer::acceptClients( uint32_t events )
+{
+   int fd;
+   while( (fd=accept4( fd_, 0, 0, SOCK_NONBLOCK|SOCK_CLOEXEC )) != -1 ) {
+      if ( clients_.size() >= MAX_CLIENTS
+           || loop_->add( fd, EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                    boost::bind(&MetricsServer::serve, this, fd, _1) ) == -1 ) {
+         ::close( fd );
+         continue;
+      }
+      clients_[fd];
+   }
+}
+
+
+//! @brief Reads a client's request and writes it the reply.
+//!
+//! The request is gathered over as many reads as it takes, however it was
+//! split, until it is whole or the client shuts down its side, so a client
+//! which only does that gets the page as well.  Only then is the reply
+//! made, HTTP or not, from a fresh page, and the connection closed once it
+//! has all been written.  No more than MAX_REQUEST bytes are ever read
+//! from a client, one which sends more is dropped, so that it can't hold
+//! the loop up or grow without end.
+//!
+//! @param fd      The client's socket.
+//! @param events  epoll event mask that fired.
+void MetricsServer::serve( int fd, uint32_t events )
+{
+   ClientMap_t::iterator iter = clients_.find( fd );
+   if ( iter == clients_.end() )
+      return;
+   Client& c = iter->second;
+
+   if ( ! c.answered ) {
+      if ( ! (events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) )
+         return;      // connected, request not sent yet
+      char buf[1024];
+      ssize_t n;
+      for( ;; ) {
+         n = ::read( fd, buf, sizeof(buf) );
+         if ( n > 0 ) {
+            c.in.append( buf, n );
+            if ( requestDone( c.in ) )
+               break;
+            if ( c.in.size() >= MAX_REQUEST ) {
+               drop( fd );
+               return;
+            }
+         }
+         else if ( n == 0 || errno != EINTR )
+            break;
+      }
+      if ( n == -1 && errno != EAGAIN ) {
+         drop( fd );
+         return;
+      }
+      if ( n == -1 && ! requestDone( c.in ) )
+         return;      // the rest of the request on the next read readiness
+
+      c.out = source_();
+      if ( c.in.compare( 0, 4, "GET " ) == 0 ) {
+         c.out = "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: " 
+                 + boost::lexical_cast<std::string>( c.out.size() ) 
+                 + "\r\n\r\n" + c.out;
+      }
+      c.answered = true;
+   }
+
+   while( c.sent < c.out.size() ) {
+      ssize_t n = ::write( fd, c.out.data() + c.sent, c.out.size() - c.sent );
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         if ( errno == EAGAIN )
+            return;   // the rest on write readiness
+         break;
+      }
+      c.sent += n;
+   }
+   drop( fd );
+}
+
+
+//! @brief Drops the clients which have been around for MAX_TICKS sweeps,
+//!        whether they never sent a whole request or never read the reply.
+//! @param events  epoll event mask that fired.
+void MetricsServer::sweep( uint32_t events )
+{
+   uint64_t expired;
+   if ( ::read( timer_, &expired, sizeof(expired) ) != sizeof(expired) )
+      return;
+   ClientMap_t::iterator iter = clients_.begin();
+   while( iter != clients_.end() ) {
+      int fd = iter->first;
+      Client& c = (iter++)->second;
+      if ( (c.ticks += expired) >= MAX_TICKS )
+         drop( fd );
+   }
+}
+
+
+//! Detaches a client from the loop and closes its connection.
+void MetricsServer::drop( int fd )
+{
+   if ( loop_ )
+      loop_->remove( fd );
+   ::close( fd );
+   clients_.erase( fd );
+}
+
+} // end namespace ntee
@@ -0,0 +1,67 @@
+#ifndef INCLUDED_METRICSSERVER_HPP
+#define INCLUDED_METRICSSERVER_HPP
+
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <boost/function.hpp>
+
+namespace ntee {
+
+class EventLoop;
+
+//! @brief Serves a text page of metrics on a local Unix-domain socket.
+//!
+//! The server is just another set of descriptors on the EventLoop, so a
+//! scrape never blocks the relays, it only waits its turn.  A client
+//! connects and sends a request, either any line or an HTTP GET, and once
+//! it is all in, however it was split up, is answered with the page
+//! handed out by the source callback, then the connection is closed.  An
+//! HTTP request gets an HTTP/1.0 reply, which is what Prometheus and curl
+//! --unix-socket expect.  Whatever the client socket can't take right away
+//! is written on write readiness.  A client which takes too long, to send
+//! its request or to read the reply, is dropped, as is one whose request
+//! grows too long.
+class MetricsServer {
+public:
+   //! Callback type, it returns the current page of metrics.
+   typedef boost::function<std::string ()> Source_t;
+
+   MetricsServer( const std::string& path, const Source_t& source );
+   ~MetricsServer();
+
+   int attach( EventLoop& loop );
+
+private:
+   MetricsServer( const MetricsServer& );
+   MetricsServer& operator=( const MetricsServer& );
+
+   //! A connected client and what is left to write to it.
+   struct Client {
+      bool answered;       //!< the request has been read, out is set
+      std::string in;      //!< the request, as far as it has come
+      std::string out;     //!< the reply
+      size_t sent;         //!< bytes of out already written
+      unsigned ticks;      //!< sweeps of the timer it has been around for
+
+      Client() : answered(false), sent(0), ticks(0) {}
+   };
+
+   typedef std::map<int, Client> ClientMap_t;
+
+   void acceptClients( uint32_t events );
+   void serve( int fd, uint32_t events );
+   void sweep( uint32_t events );
+   void drop( int fd );
+
+   std::string path_;      //!< file system name of the socket
+   Source_t source_;       //!< where the page comes from
+   int fd_;                //!< listening socket, -1 if not bound
+   int timer_;             //!< timerfd which drops slow clients, or -1
+   EventLoop* loop_;       //!< loop we are attached to, if any
+   ClientMap_t clients_;   //!< connected clients, by descriptor
+};
+
+} // end namespace ntee
+
+#endif
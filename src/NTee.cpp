@@ -5,10 +5,14 @@
 #include "UnixSignalHub.hpp"
 #include "comm.hpp"
 #include "TCPSocket.hpp"
+#include "UDPSocket.hpp"
+#include "DatagramRelay.hpp"
+#include "Uring.hpp"
 #include "IPAddress.hpp"
+#include "Session.hpp"
+#include "MetricsServer.hpp"
 #include <errno.h>
 #include <algorithm>
-#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
@@ -19,6 +23,8 @@
 #include <fcntl.h>
 #include <string.h>
 #include <cstdio>
+#include <sstream>
+#include <vector>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
@@ -26,6 +32,63 @@
 
 namespace ntee {
 
+//! Submission ring size of the io_uring engine.
+static const unsigned URING_ENTRIES = 1024;
+
+//! Number of BufferPool slabs registered with the io_uring engine.
+static const size_t URING_SLABS = 2;
+
+//! Label values of the directions, by TransferType.
+static const char* DIR_LABELS[] = { "L_to_R", "R_to_L" };
+
+
+//! @brief One metric read out of the RelayStats, for metrics().
+struct RelayMetric {
+   const char* name;                     //!< without the ntee_ prefix
+   const char* type;                     //!< counter or gauge
+   const char* help;                     //!< the HELP text
+   double (*value)( const RelayStats& ); //!< reads it out
+};
+
+static double bytes( const RelayStats& s ) { return s.bytes; }
+static double messages( const RelayStats& s ) { return s.latency.count(); }
+static double reads( const RelayStats& s ) { return s.reads.calls; }
+static double readAgain( const RelayStats& s ) { return s.reads.again; }
+static double writes( const RelayStats& s ) { return s.writes.calls; }
+static double writeAgain( const RelayStats& s ) { return s.writes.again; }
+static double queued( const RelayStats& s ) { return s.queued; }
+static double peakQueued( const RelayStats& s ) { return s.peakQueued; }
+static double stalls( const RelayStats& s ) { return s.stalls; }
+static double stallSecs( const RelayStats& s ) { return s.stallNsec / 1e9; }
+static double dropped( const RelayStats& s ) { return s.dropped; }
+
+static const RelayMetric RELAY_METRICS[] = {
+   { "bytes_total", "counter", "Bytes written to the receiving side.", bytes },
+   { "messages_total", "counter", "Messages relayed: reads, pipe loads or "
+     "datagrams passed on in full.", messages },
+   { "read_calls_total", "counter", "Read calls made on the sending side.", 
+     reads },
+   { "read_eagain_total", "counter", "Reads which found nothing to read.",
+     readAgain },
+   { "write_calls_total", "counter", "Write calls made on the receiving side.",
+     writes },
+   { "write_eagain_total", "counter", "Writes which found no room to write.",
+     writeAgain },
+   { "queue_bytes", "gauge", "Bytes read but not yet written.", queued },
+   { "queue_peak_bytes", "gauge", "Most bytes ever waiting at once.",
+     peakQueued },
+   { "stalls_total", "counter", "Times reading paused for the receiver.",
+     stalls },
+   { "stall_seconds_total", "counter", "Time reading was paused.", 
+     stallSecs },
+   { "dropped_datagrams_total", "counter", "Datagrams the receiver had no "
+     "room for.", dropped }
+};
+
+static const size_t RELAY_METRIC_COUNT = 
+   sizeof(RELAY_METRICS) / sizeof(RELAY_METRICS[0]);
+
+
 //! Instantiates a NTee instance with provided settings.
 //!
 //! Creates the instance, and stores a const reference to the Settings structure
@@ -33,16 +96,29 @@ namespace ntee {
 //!
 //! @param s    The filled in Settings structure to work off of.
 //!
-NTee::NTee( const Settings& s ) : s_(s), Lsock_(0), Rsock_(0) 
+NTee::NTee( const Settings& s ) : s_(s), srvPort_(0), svc_(0), nextId_(0)
 {
-   Lsock_ = new TCPSocket("L");
+   reportPipe_[0] = reportPipe_[1] = -1;
 }
 
 
 //! Destructor.  Virtual so deriving classes can write their own if need be.
+//! Any sessions still open are closed.
 NTee::~NTee()
 {
-   // empty
+   metrics_.reset();
+   sessions_.clear();
+   ended_.clear();
+   dgram_.reset();
+   ring_.reset();
+   for( int i=0; i < 2; ++i ) {
+      if ( reportPipe_[i] != -1 )
+         ::close( reportPipe_[i] );
+   }
+   if ( svc_ ) {
+      svc_->close();
+      delete svc_;
+   }
 }
 
 
@@ -61,7 +137,12 @@ void NTee::childExited( int sig )
    
    int exitWith = WEXITSTATUS(status);
    
-   // We can't shutdown the Lsock_ socket, even though we know that the R
+   // Datagrams have no end of file to tell us R is done, so a single UDP
+   // session ends with R itself.
+   if ( s_.protocol == Settings::UDP && ! s_.multi_session )
+      loop_.stop();
+   
+   // We can't shutdown the L socket, even though we know that the R
    // side won't be communicating anymore, because there still could be stuff
    // left on the R socket to read... and send.  But it should be returning
    // EOF real soon.
@@ -123,7 +204,11 @@ void NTee::startChildProc() {
 //!          NTee instance's serverhost_ and srvPort_ members.
 Socket* NTee::constructService( )
 {
-   Socket* svc = new TCPSocket("Service");
+   Socket* svc;
+   if ( s_.protocol == Settings::UDP )
+      svc = new UDPSocket("Service");
+   else
+      svc = new TCPSocket("Service");
    serverhost_ = s_.srv_host;
    srvPort_ = s_.srv_port;
    IPAddress ipaddr( serverhost_.c_str(), srvPort_ );   
@@ -139,73 +224,346 @@ Socket* NTee::constructService( )
    
 
 
-//! @brief  Listens to both the L and R sockets.
+//! @brief  Connects a new socket to the L side process.
 //!
-//! This routine will listen to both the L and R side sockets, and pass 
-//! any information recieved from one side to the other as well as make
-//! a recording of the communication.
-void NTee::startListening()
+//! @returns a dynamically allocated, connected Socket, or NULL with errno
+//!          set if the L side could not be reached.
+Socket* NTee::connectL()
+{
+   Socket* L = new TCPSocket("L");
+   IPAddress lip( s_.L_host_ip.c_str(), s_.L_port.c_str());
+   if ( L->connectTo(lip) == -1 ) {
+      int err = errno;
+      L->close();
+      delete L;
+      errno = err;
+      return 0;
+   }
+   return L;
+}
+
+
+//! @brief  Pairs an R side connection with a fresh L side connection.
+//!
+//! Connects to the L side, then builds a Session from the two sockets,
+//! inserts it into the session table and attaches it to the event loop.
+//! If the L side can't be reached, in multi-session mode the R connection
+//! is dropped and the others carry on; with a single session there is
+//! nothing left to do, and the program is terminated.
+//!
+//! @param R   Dynamically allocated, accepted R side socket.  Ownership is
+//!            taken over in all cases.
+void NTee::openSession( Socket* R )
+{
+   Socket* L = connectL();
+   SysErrIf( L == 0 && ! s_.multi_session )
+      .info("Unable to connect to L side %s:%s\n",
+            s_.L_host_ip.c_str(), s_.L_port.c_str());
+   WarnIf( L == 0 ).info("Unable to connect to L side %s:%s, dropping R\n",
+                         s_.L_host_ip.c_str(), s_.L_port.c_str());
+   if ( L == 0 ) {
+      R->close();
+      delete R;
+      return;
+   }
+   
+   unsigned int id = nextId_++;
+   boost::shared_ptr<Session> session( new Session(*this, id, L, R) );
+   sessions_[id] = session;
+   if ( ring_ ) {
+      session->start( *ring_ );
+      ring_->submit();
+   }
+   else
+      SysErrIf( session->attach(loop_) == -1 );
+   std::cout << "NTee session " << id << " connected to L side: " 
+             << s_.L_host_ip << ":" << s_.L_port << "\n";
+}
+
+
+//! @brief  Accepts every pending R side connection.
+//!
+//! Called back by the event loop when the service socket is readable in
+//! multi-session mode.  The socket is edge-triggered, so accept is called
+//! until there is nobody left waiting.
+//!
+//! @param events  epoll event mask that fired.
+void NTee::acceptSessions( uint32_t events )
 {
-   int rc=0;
-   fd_set rd_fds;
-   int max = std::max(Lsock_->getFD(),Rsock_->getFD());
+   Socket* R;
+   while( (R=svc_->accept("R")) != 0 ) {
+      openSession( R );
+   }
+}
+
 
-   // force both L and R sockets to be non-blocking IO.
-   fcntl(Lsock_->getFD(), F_SETFL, O_NONBLOCK);
-   fcntl(Rsock_->getFD(), F_SETFL, O_NONBLOCK);
+//! @brief  Removes a finished session from the session table.
+//!
+//! Called by a Session once its sockets have been closed.  The call comes
+//! from within the Session, so it is only freed once the event loop has
+//! dispatched the events at hand.  When running a single session there is
+//! nothing more to do, so the loop is stopped.
+//!
+//! @param id   Id of the session which ended.
+void NTee::sessionEnded( unsigned int id )
+{
+   std::cout << "NTee session " << id << " ended\n";
+   SessionMap_t::iterator iter = sessions_.find( id );
+   if ( iter != sessions_.end() ) {
+      retire( *iter->second );
+      if ( ended_.empty() )
+         loop_.defer( boost::bind(&NTee::freeEnded, this) );
+      ended_.push_back( iter->second );
+      sessions_.erase( iter );
+   }
+   if ( ! s_.multi_session )
+      loop_.stop();
+}
+
+
+//! @brief  Frees the sessions which have ended.
+void NTee::freeEnded()
+{
+   ended_.clear();
+}
+
+
+//! @brief  Adds a session's flow control counters to the totals kept for
+//!         sessions which have ended.
+void NTee::retire( const Session& s )
+{
+   retired_[L_to_R] += s.relay( L_to_R ).stats();
+   retired_[R_to_L] += s.relay( R_to_L ).stats();
+}
+
+
+//! @brief  Sums the flow control counters of one direction.
+//!
+//! @param dir   L_to_R or R_to_L.
+//! @returns the counters of all the ended sessions plus the live ones.
+RelayStats NTee::stats( TransferType dir ) const
+{
+   RelayStats sum = retired_[dir];
+   if ( dgram_ )
+      sum += dgram_->stats( dir );
+   SessionMap_t::const_iterator iter = sessions_.begin();
+   for( ; iter != sessions_.end(); ++iter )
+      sum += iter->second->relay( dir ).stats();
+   return sum;
+}
+
+
+//! @brief  Prints the flow control counters and the relay latency of both
+//!         directions to stderr.
+//!
+//! The latency is the time from a message being read to its last byte
+//! being written to the other side, that is the delay ntee adds.
+void NTee::report() const
+{
+   static const char* names[] = { "L to R", "R to L" };
+   for( int dir=L_to_R; dir <= R_to_L; ++dir ) {
+      RelayStats st = stats( (TransferType) dir );
+      std::cerr << names[dir] << ": " << st.bytes << " bytes, queue peak " 
+                << st.peakQueued << " bytes, stalled " << st.stalls 
+                << " times for " << st.stallNsec / 1000000 << " ms";
+      if ( s_.protocol == Settings::UDP )
+         std::cerr << ", dropped " << st.dropped << " datagrams";
+      std::cerr << "\n";
       
-   FD_ZERO(&rd_fds);
-   FD_SET(Lsock_->getFD(), &rd_fds);
-   FD_SET(Rsock_->getFD(), &rd_fds);
+      const Histogram& h = st.latency;
+      std::cerr << names[dir] << " latency (usec): " << h.count() 
+                << " messages, p50 " << h.percentile(50) / 1000.0
+                << ", p99 " << h.percentile(99) / 1000.0
+                << ", p99.9 " << h.percentile(99.9) / 1000.0
+                << ", max " << h.max() / 1000.0 << "\n";
+   }
+}
+
+
+//! @brief  Asks for a report from a SIGUSR1 handler.
+//!
+//! Printing is not safe in a signal handler, so this only writes a byte
+//! to the report pipe, and the event loop calls reportRequested().
+//!
+//! @param sig   Signal number recieved.
+void NTee::reportSignal( int sig )
+{
+   char c = 0;
+   ssize_t rc = ::write( reportPipe_[1], &c, 1 );
+   (void) rc;     // if the pipe is full a report is coming anyway
+}
+
+
+//! @brief  Prints a report when asked to with SIGUSR1.
+//! @param events  epoll event mask that fired.
+void NTee::reportRequested( uint32_t events )
+{
+   char buf[64];
+   while( ::read( reportPipe_[0], buf, sizeof(buf) ) > 0 ) {
+      /* empty the pipe */
+   }
+   report();
+}
+
+
+//! @brief  Writes out the metrics page in the Prometheus text format.
+//!
+//! The ntee_ metrics are the totals of each direction since start up,
+//! ended sessions included, the ntee_session_ ones are those of each live
+//! session.  The recorders are told apart by the order they were added.
+//!
+//! @returns the page.
+std::string NTee::metrics() const
+{
+   std::vector<SessionStats> live;
+   SessionMap_t::const_iterator iter = sessions_.begin();
+   for( ; iter != sessions_.end(); ++iter ) {
+      SessionStats ss;
+      ss.id = iter->first;
+      ss.dir[L_to_R] = &iter->second->relay( L_to_R ).stats();
+      ss.dir[R_to_L] = &iter->second->relay( R_to_L ).stats();
+      live.push_back( ss );
+   }
+   if ( dgram_ )
+      dgram_->sessions( live );
+   RelayStats total[2] = { stats( L_to_R ), stats( R_to_L ) };
    
-   std::string msg;
-   char buf[1024];
+   std::ostringstream out;
+   out.precision( 15 );    // byte counters must not turn into 1.2e+09
+   out << "# HELP ntee_sessions Sessions open now.\n"
+       << "# TYPE ntee_sessions gauge\n"
+       << "ntee_sessions " << live.size() << "\n"
+       << "# HELP ntee_sessions_total Sessions opened since start up.\n"
+       << "# TYPE ntee_sessions_total counter\n"
+       << "ntee_sessions_total " << nextId_ << "\n";
    
-   try_again:
-   while( (rc=select(max+1, &rd_fds, 0, 0, 0)) > 0 ) {
-         
-      if ( FD_ISSET( Lsock_->getFD(), &rd_fds ) )
-         transfer(*Lsock_,*Rsock_);
-         
-      if ( FD_ISSET( Rsock_->getFD(), &rd_fds ) )
-         transfer(*Rsock_,*Lsock_);
-      
-      FD_ZERO(&rd_fds);
-      FD_SET(Lsock_->getFD(), &rd_fds);
-      FD_SET(Rsock_->getFD(), &rd_fds);
-      
+   for( size_t m=0; m < RELAY_METRIC_COUNT; ++m ) {
+      const RelayMetric& rm = RELAY_METRICS[m];
+      out << "# HELP ntee_" << rm.name << " " << rm.help << "\n"
+          << "# TYPE ntee_" << rm.name << " " << rm.type << "\n";
+      for( int dir=L_to_R; dir <= R_to_L; ++dir )
+         out << "ntee_" << rm.name << "{direction=\"" << DIR_LABELS[dir]
+             << "\"} " << rm.value( total[dir] ) << "\n";
    }
-   if ( rc == -1 && errno == EINTR ) {
-      goto try_again;    // SIGCHLD came in, but there could be still some
-                         // data left to read. Goto's are bad form, but here
-                         // we get a lot less code for using it.
+   
+   out << "# HELP ntee_latency_seconds Time from read to the last byte "
+          "written.\n"
+       << "# TYPE ntee_latency_seconds summary\n";
+   static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+   for( int dir=L_to_R; dir <= R_to_L; ++dir ) {
+      const Histogram& h = total[dir].latency;
+      for( size_t q=0; q < sizeof(quantiles)/sizeof(quantiles[0]); ++q )
+         out << "ntee_latency_seconds{direction=\"" << DIR_LABELS[dir]
+             << "\",quantile=\"" << quantiles[q] << "\"} " 
+             << h.percentile( quantiles[q] * 100 ) / 1e9 << "\n";
+      out << "ntee_latency_seconds_sum{direction=\"" << DIR_LABELS[dir] 
+          << "\"} " << h.sum() / 1e9 << "\n"
+          << "ntee_latency_seconds_count{direction=\"" << DIR_LABELS[dir]
+          << "\"} " << h.count() << "\n";
    }
    
-}   
+   for( size_t m=0; m < RELAY_METRIC_COUNT; ++m ) {
+      const RelayMetric& rm = RELAY_METRICS[m];
+      out << "# HELP ntee_session_" << rm.name << " " << rm.help << "\n"
+          << "# TYPE ntee_session_" << rm.name << " " << rm.type << "\n";
+      for( size_t i=0; i < live.size(); ++i ) {
+         for( int dir=L_to_R; dir <= R_to_L; ++dir )
+            out << "ntee_session_" << rm.name << "{session=\"" << live[i].id
+                << "\",direction=\"" << DIR_LABELS[dir] << "\"} " 
+                << rm.value( *live[i].dir[dir] ) << "\n";
+      }
+   }
+   
+   out << "# HELP ntee_recorder_lag_records Records waiting to be written.\n"
+       << "# TYPE ntee_recorder_lag_records gauge\n";
+   RecCont_t::const_iterator rec = recorders_.begin();
+   for( int i=0; rec != recorders_.end(); ++rec, ++i )
+      out << "ntee_recorder_lag_records{recorder=\"" << i << "\"} " 
+          << (*rec)->lag() << "\n";
+   out << "# HELP ntee_recorder_dropped_total Records thrown away.\n"
+       << "# TYPE ntee_recorder_dropped_total counter\n";
+   rec = recorders_.begin();
+   for( int i=0; rec != recorders_.end(); ++rec, ++i )
+      out << "ntee_recorder_dropped_total{recorder=\"" << i << "\"} " 
+          << (*rec)->dropped() << "\n";
+   
+   return out.str();
+}
 
 
-//! @brief Read N , then Write it.
+//! @brief  Sets up the io_uring engine.
 //!
-//! Reads N bytes of data from the socket and puts the buffer which
-//! had been dynamically allocated during the read function (with 
-//! malloc not new) into a shared_ptr. Scoped_ptr didn't offer the
-//! functionality of specifying a DE-allocator method, and that's 
-//! why I didn't use it here.  If data had been read (eg len>0), then
-//! a Write call is made to the alternate program. If len was returned
-//! as zero, then the from socket is closed.
-//! 
-void NTee::transfer( const Socket& from, const Socket& to )
+//! The ring's completion eventfd joins the event loop, so accepting new
+//! sessions and signals work the same with either engine.  If the ring
+//! can't be had, the sessions stay on epoll.
+void NTee::startEngine()
+{
+   ring_.reset( new Uring( URING_ENTRIES, URING_SLABS ) );
+   WarnIf( ! ring_->good() ).info("Unable to set up io_uring (%s), "
+                                  "using epoll\n", strerror(errno));
+   if ( ! ring_->good() ) {
+      ring_.reset();
+      return;
+   }
+   SysErrIf( loop_.add( ring_->eventfd(), EPOLLIN,
+                        boost::bind(&NTee::reap, this, _1) ) == -1 );
+}
+
+
+//! @brief  Runs the completions of the io_uring engine.
+//! @param events  epoll event mask that fired.
+void NTee::reap( uint32_t events )
 {
-   char* buf = 0;
-   size_t len = read_n( from.getFD(), &buf );
-   boost::shared_ptr<char> ptr( buf, free );
+   ring_->reap();
+}
 
-   if ( len > 0 )
-      write_n( to.getFD(), buf, len );
-   else
-      close(from.getFD());
 
-   alertRecorders(from, to, buf, len);
+//! @brief  Listens to all of the L and R sockets.
+//!
+//! This routine will listen to the L and R side sockets of every session,
+//! and pass any information recieved from one side to the other as well as
+//! make a recording of the communication.  In multi-session mode the
+//! service socket is also watched, and new R connections become new
+//! sessions.  Returns when the loop is stopped, or straight away if there
+//! is nothing to relay.
+void NTee::startListening()
+{
+   // The TCP service is only still open in multi-session mode.
+   if ( svc_ ) {
+      fcntl(svc_->getFD(), F_SETFL, O_NONBLOCK);
+      SysErrIf( loop_.add( svc_->getFD(), EPOLLIN,
+                           boost::bind(&NTee::acceptSessions, this, _1) ) == -1 );
+   }
+   
+   // The report pipe and the ring's eventfd stay registered for good, so
+   // the loop never runs dry.  Without a session, a service or a datagram
+   // relay nothing would ever stop it.
+   if ( svc_ || dgram_ || ! sessions_.empty() )
+      loop_.run();
+   
+   metrics_.reset();
+   if ( svc_ )
+      loop_.remove( svc_->getFD() );
+   SessionMap_t::iterator iter = sessions_.begin();
+   for( ; iter != sessions_.end(); ++iter )
+      retire( *iter->second );
+   sessions_.clear();
+   ended_.clear();
+   if ( ring_ )
+      loop_.remove( ring_->eventfd() );
+   loop_.remove( reportPipe_[0] );
+}   
+
+
+//! @brief  Stops the event loop on SIGINT or SIGTERM.
+//!
+//! Lets start() shut the recorders down gracefully so that nothing
+//! recorded is lost when ntee is told to quit.
+//!
+//! @param sig   Signal number recieved.
+void NTee::interrupted( int sig )
+{
+   loop_.stop();
 }
 
 
@@ -213,24 +571,16 @@ void NTee::transfer( const Socket& from, const Socket& to )
 //!
 //! This routine loops over the recorders_ container kept by the 
 //! NTee instance, calling the record() method of each Recorder instance
-//! in turn.<br>
-//! <b>NOTES:</b><br><ul>
-//! <li>In the future, I'd like to be able to use boost::bind in a 
-//!     for_each call, but this caused copies of the Socket instances which
-//!     when they terminated, closed the descriptors.
-//! <li>Also in the future, it might be good to put these writes into 
-//!     another thread so they don't block the select loop from fetching
-//!     the next message. NTee should be as transparent as possible to the
-//!     timing of messages between R and L programs.
-//! </ul>
+//! in turn.  The recorders added by ntee_main are AsyncRecorders, so the
+//! writes happen on their own threads and don't block the event loop from
+//! fetching the next message.  NTee should be as transparent as possible
+//! to the timing of messages between R and L programs.
 //! 
-void NTee::alertRecorders(const Socket& from, const Socket& to, 
-                          const char* buf, 
-                          size_t len)
+void NTee::alertRecorders( const Buffer& buf )
 {
    RecCont_t::iterator iter= recorders_.begin();
    for( ; iter != recorders_.end(); ++iter ) {
-      (*iter)->record(from, to, buf, len);
+      (*iter)->record(buf);
    }
 }
 
@@ -242,8 +592,10 @@ void NTee::alertRecorders(const Socket& from, const Socket& to,
 //! middle man service.  First step, listen for the R side client.  Next
 //! step, connect with the L side service.  From this point forward the
 //! two processes are now in communication through ntee, this routine 
-//! falls into an infinite select loop on both the R side and L side 
-//! connection points.
+//! falls into an epoll event loop on both the R side and L side 
+//! connection points.  In multi-session mode the service stays open and
+//! every R side client which connects is given its own L connection.
+//! With UDP every R side address which sends a datagram is a session.
 //!
 //! @returns status of the commands.  In reality though, the program
 //!          exits when it first goes wrong, which is really not a good
@@ -252,36 +604,64 @@ void NTee::alertRecorders(const Socket& from, const Socket& to,
 int NTee::start()
 {
    //** Build up the service port.
-   Socket* svc = constructService();
+   svc_ = constructService();
    
-   //** Not going to accept yet! Instead, we start the client.
-   startChildProc();
-         
-   // Back in the parent (ntee) otherwise we'd have exited.
-   SysErrIf( (Rsock_=svc->accept("R")) == 0 );
-   svc->close();
-   delete svc;
-      
-   // Report the client connection.
-//   char buf[INET_ADDRSTRLEN];
-//   inet_ntop(AF_INET, &addr, buf, sizeof(addr));   
-//   std::cout << "Client connection: " << buf
-//             << ":" << ntohs(addr.sin_port) << "\n";
+   //** Not going to accept yet! Instead, we start the client.  In multi-
+   //** session mode the R side clients may be started by someone else.
+   if ( s_.R_cmd )
+      startChildProc();
    
-   //** R process has connected... time to connect to the L process.
-   int type = (s_.protocol==Settings::TCP)? SOCK_STREAM : SOCK_DGRAM;   
-   IPAddress lip( s_.L_host_ip.c_str(), s_.L_port.c_str());
-   SysErrIf( Lsock_->connectTo(lip) == -1 );                       
-   std::cout << "NTee connected to L side: " << s_.L_host_ip << ":"
-             << s_.L_port << "\n";
+   //** A peer going away mid-write must not kill ntee, the write just fails.
+   //** (Set after the fork, SIG_IGN would be inherited through the exec.)
+   signal( SIGPIPE, SIG_IGN );
+   
+   UnixSignalHub::trap(SIGINT, boost::bind( &NTee::interrupted, this, _1 ));
+   UnixSignalHub::trap(SIGTERM, boost::bind( &NTee::interrupted, this, _1 ));
+   
+   //** SIGUSR1 prints the counters and latencies so far.
+   SysErrIf( pipe2( reportPipe_, O_NONBLOCK|O_CLOEXEC ) == -1 );
+   SysErrIf( loop_.add( reportPipe_[0], EPOLLIN,
+                        boost::bind(&NTee::reportRequested, this, _1) ) == -1 );
+   UnixSignalHub::trap(SIGUSR1, boost::bind( &NTee::reportSignal, this, _1 ));
+   
+   //** Live counters for anybody who asks on the metrics socket.
+   if ( ! s_.metrics_path.empty() ) {
+      metrics_.reset( new MetricsServer( s_.metrics_path, 
+                                         boost::bind(&NTee::metrics, this) ) );
+      SysErrIf( metrics_->attach(loop_) == -1 );
+   }
+   
+   //** The io_uring engine only drives TCP sessions, UDP is batched anyway.
+   if ( s_.protocol == Settings::TCP && s_.engine == Settings::URING )
+      startEngine();
    
-   //** Start listening to both sides and passing the information.
+   if ( s_.protocol == Settings::UDP ) {
+      // No connections, the R side peers are picked out of the datagrams.
+      dgram_.reset( new DatagramRelay(*this, static_cast<UDPSocket*>(svc_)) );
+      svc_ = 0;
+      SysErrIf( dgram_->attach(loop_) == -1 );
+   }
+   else if ( ! s_.multi_session ) {
+      // Back in the parent (ntee) otherwise we'd have exited.
+      Socket* R;
+      SysErrIf( (R=svc_->accept("R")) == 0 );
+      svc_->close();
+      delete svc_;
+      svc_ = 0;
+      
+      //** R process has connected... time to connect to the L process.
+      openSession( R );
+   }
+   
+   //** Start listening to all sides and passing the information.
    startListening();
    
    //** shut down all recorders
    std::for_each( recorders_.begin(), recorders_.end(),
                   boost::bind(&Recorder::shutdown, _1));
    
+   report();
+   
    return 0;
 }
 
@@ -2,9 +2,15 @@
 #define INCLUDED_NTEE_HPP
 
 #include <list>
+#include <map>
 #include <string>
+#include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include "Socket.hpp"
+#include "Buffer.hpp"
+#include "EventLoop.hpp"
+#include "Relay.hpp"
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -14,6 +20,11 @@ namespace ntee {
 
 // forward declaration
 class Settings;
+class Relay;
+class Session;
+class DatagramRelay;
+class Uring;
+class MetricsServer;
 
 
 //! An interface class which abstracts the behavior of recording data.
@@ -24,19 +35,26 @@ public:
    
    //! Called once for each message transferred by the NTee instance. Durning
    //! this callback the Recorder implementation should transfer the message
-   //! data to its target.
-   //! @param from   Message data is coming from this Socket.
-   //! @param to     Message data is going to be sent to this Socket.
-   //! @param buf    The message buffer itself.
-   //! @param len    Size of the message buffer.
+   //! data to its target.  The Buffer only lives for the duration of the
+   //! call, and records may arrive on a thread other than the relay's.
+   //! @param buf    The message itself.  Its type tells the direction, its
+   //!               ts when it was read, and its session which L/R
+   //!               connection pair it belongs to (always 0 unless running
+   //!               multi-session).
    //!
-   virtual void record( const Socket& from, const Socket& to, 
-                        const char* buf, size_t len ) = 0;
+   virtual void record( const Buffer& buf ) = 0;
    
    //! Called when all the sockets have closed and there is no more information
    //! to be recorded.  This allows the Record implementation the opportunity
    //! to gracefully shut itself down, and return any resources.
    virtual void shutdown() = 0;
+
+   //! @returns the number of records taken but not yet written out.  Only
+   //!          recorders which queue records have anything to report.
+   virtual size_t lag() const { return 0; }
+
+   //! @returns the number of records thrown away rather than written.
+   virtual uint64_t dropped() const { return 0; }
 };
 
 
@@ -49,6 +67,8 @@ public:
    virtual int start();
    
    void addRecorder( const boost::shared_ptr<Recorder>& );
+   
+   RelayStats stats( TransferType dir ) const;
 
 protected:
    const Settings& s_;   //!< The information from command line args
@@ -57,20 +77,45 @@ private:
    
    void startChildProc();
    Socket* constructService();
+   Socket* connectL();
+   void startEngine();
    void startListening();
-   void transfer(const Socket&, const Socket& );
-   void alertRecorders( const Socket&, const Socket&, 
-                        const char*, size_t len );
+   void acceptSessions( uint32_t events );
+   void openSession( Socket* R );
+   void sessionEnded( unsigned int id );
+   void freeEnded();
+   void retire( const Session& );
+   void report() const;
+   void alertRecorders( const Buffer& );
    void childExited( int );
+   void interrupted( int );
+   void reap( uint32_t events );
+   void reportSignal( int );
+   void reportRequested( uint32_t events );
+   std::string metrics() const;
+   
+   friend class Relay;
+   friend class Session;
+   friend class DatagramRelay;
    
    typedef std::list<boost::shared_ptr<Recorder> > RecCont_t;
+   typedef std::map<unsigned int, boost::shared_ptr<Session> > SessionMap_t;
+   typedef std::vector<boost::shared_ptr<Session> > SessionList_t;
    
    RecCont_t recorders_;
    std::string serverhost_;
    std::string serverip_;
    unsigned int srvPort_;
-   Socket* Lsock_;
-   Socket* Rsock_;
+   Socket* svc_;              //!< service socket, kept open in multi-session
+   SessionMap_t sessions_;    //!< live sessions, by session id
+   SessionList_t ended_;      //!< ended sessions, freed after dispatch
+   unsigned int nextId_;      //!< id given to the next session
+   RelayStats retired_[2];    //!< totals of ended sessions, by TransferType
+   boost::scoped_ptr<DatagramRelay> dgram_;   //!< the relay when using UDP
+   boost::scoped_ptr<Uring> ring_;  //!< the io_uring engine, if in use
+   int reportPipe_[2];        //!< SIGUSR1 to event loop, asks for report()
+   boost::scoped_ptr<MetricsServer> metrics_;  //!< serves metrics(), if asked
+   EventLoop loop_;
 };
 
 } // end namespace ntee
@@ -3,11 +3,401 @@
 #include "BinaryDataReader.hpp"
 #include "Error.hpp"
 #include "IPAddress.hpp"
+#include "EventLoop.hpp"
+#include "StreamHash.hpp"
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 using namespace ntee;
 
 
+//! How close to its time a send stops sleeping and spins instead, in
+//! nsec.  Waking up from a sleep takes up to about this, even with the
+//! timer slack cut down.
+static const uint64_t SPIN_NSEC = 200000;
+
+
+//! @returns CLOCK_MONOTONIC now in nsec.
+static uint64_t monoNow()
+{
+   timespec now;
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+//! @brief  Waits for an absolute CLOCK_MONOTONIC time.
+//!
+//! Sleeps until SPIN_NSEC before it, and spins for the rest, so that the
+//! wake up doesn't make it late.
+//!
+//! @param due  the time, in nsec.
+//! @returns the time it was left, due or a little after.
+static uint64_t waitUntil( uint64_t due )
+{
+   uint64_t now = monoNow();
+   if ( due > now + SPIN_NSEC ) {
+      timespec ts;
+      ts.tv_sec = (due - SPIN_NSEC) / 1000000000ULL;
+      ts.tv_nsec = (due - SPIN_NSEC) % 1000000000ULL;
+      while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0 ) == EINTR )
+         ;
+   }
+   while( (now = monoNow()) < due )
+      ;
+   return now;
+}
+
+
+//! @brief Matches what the other side sends against its records.
+//!
+//! The other side's records are expected one after the other as a byte
+//! stream, and what comes in is cut up against them however TCP split or
+//! joined it.  Each record's bytes are hashed with a StreamHash as they
+//! come, and checked against the hash of the record once the last of
+//! them is in.  Bytes which come before their record is expected are held
+//! until it is.
+class ReplyMatcher {
+public:
+   ReplyMatcher() : count_(0), differ_(0), lastTime_(0) {}
+
+   void expect( const RecordView& r );
+   size_t feed( const char* p, size_t n );
+
+   //! @returns the number of records expected and not in yet.
+   size_t outstanding() const { return q_.size(); }
+
+   //! @returns the bytes still to come of the records expected.
+   uint64_t owed() const;
+
+   //! @returns the number of records which came in different.
+   uint64_t differ() const { return differ_; }
+
+   //! @returns the bytes which came in beyond the records expected.
+   size_t extra() const { return early_.size(); }
+
+   //! @returns the recorded time of the last record in.
+   uint64_t lastTime() const { return lastTime_; }
+
+private:
+   //! A record of the other side's, as far as it has come.
+   struct Expected {
+      uint64_t n;        //!< number of the record among the other side's
+      uint64_t hash;     //!< StreamHash of the record
+      uint64_t time;     //!< when it was recorded
+      uint32_t len;      //!< length of the record
+      uint32_t got;      //!< bytes of it in so far
+   };
+
+   std::deque<Expected> q_;   //!< records awaited, oldest first
+   StreamHash h_;             //!< of the bytes in of q_.front()
+   std::string early_;        //!< bytes in before their record was expected
+   uint64_t count_;           //!< records expected so far
+   uint64_t differ_;
+   uint64_t lastTime_;
+};
+
+
+//! @brief Adds the next of the other side's records to what is awaited.
+//!
+//! Empty records are passed over, there is nothing to wait for.
+//!
+//! @param r  the record.
+void ReplyMatcher::expect( const RecordView& r )
+{
+   uint64_t n = count_++;
+   if ( r.len == 0 )
+      return;
+   Expected e;
+   e.n = n;
+   e.hash = StreamHash::of( r.data, r.len );
+   e.time = r.time;
+   e.len = r.len;
+   e.got = 0;
+   q_.push_back( e );
+   if ( ! early_.empty() ) {
+      std::string held;
+      held.swap( early_ );
+      feed( held.data(), held.size() );
+   }
+}
+
+
+//! @brief Matches bytes which came in against the records awaited.
+//!
+//! @param p  the bytes.
+//! @param n  how many.
+//! @returns the number of records completed by them.
+size_t ReplyMatcher::feed( const char* p, size_t n )
+{
+   size_t done = 0;
+   while( n > 0 && ! q_.empty() ) {
+      Expected& e = q_.front();
+      size_t take = std::min( n, (size_t) (e.len - e.got) );
+      h_.update( p, take );
+      e.got += take;
+      p += take;
+      n -= take;
+      if ( e.got < e.len )
+         break;
+      if ( h_.value() != e.hash ) {
+         ++differ_;
+         std::cerr << "Message " << e.n << " from the other side differs "
+                   << "from the recording (" << e.len << " bytes).\n";
+      }
+      lastTime_ = e.time;
+      h_.reset();
+      q_.pop_front();
+      ++done;
+   }
+   early_.append( p, n );
+   return done;
+}
+
+
+uint64_t ReplyMatcher::owed() const
+{
+   uint64_t bytes = 0;
+   for( size_t i=0; i < q_.size(); ++i )
+      bytes += q_[i].len - q_[i].got;
+   return bytes;
+}
+
+
+//! @brief What a group of connections of a fanOut(), those sharing a
+//!        thread, measured.
+struct ReplayGroup {
+   uint64_t exchanges;   //!< answers from the other side, in full
+   uint64_t sent;        //!< bytes sent
+   uint64_t received;    //!< bytes received
+   unsigned conns;       //!< connections played over
+   unsigned failed;      //!< connections which ended before the file did
+   double secs;          //!< how long the last connection took to finish
+   Histogram latency;    //!< nsec from the end of a send to the answer
+
+   ReplayGroup() 
+    : exchanges(0), sent(0), received(0), conns(0), failed(0), secs(0) {}
+
+   ReplayGroup& operator+=( const ReplayGroup& o )
+   {
+      exchanges += o.exchanges;
+      sent += o.sent;
+      received += o.received;
+      conns += o.conns;
+      failed += o.failed;
+      secs = std::max( secs, o.secs );
+      latency += o.latency;
+      return *this;
+   }
+};
+
+
+//! @brief One connection of a fanOut().
+//!
+//! Plays the file over its own socket in step with the other side, as
+//! playback() does, but without blocking, so that a thread's EventLoop
+//! can drive many of them.  Every connection walks the one shared mapping
+//! of the file with its own iterator.  The other side's messages are only
+//! counted, against the lengths of its records.  The time from the end of
+//! this side's last message to the last byte of the other side's answer
+//! goes into the group's latency.
+class ReplayConn {
+public:
+   ReplayConn( BinaryDataReader::iterator from, BinaryDataReader::iterator to,
+               TransferType mine, ReplayGroup& g );
+   ~ReplayConn();
+
+   int open( Socket* pS, EventLoop& loop );
+
+private:
+   ReplayConn( const ReplayConn& );
+   ReplayConn& operator=( const ReplayConn& );
+
+   void onEvent( uint32_t events );
+   bool step();
+   void answered();
+   void close();
+
+   BinaryDataReader::iterator it_;    //!< record being played
+   BinaryDataReader::iterator end_;
+   TransferType mine_;                //!< direction of this side's records
+   ReplayGroup& g_;
+   boost::scoped_ptr<Socket> sock_;
+   EventLoop* loop_;
+   size_t sent_;                      //!< bytes of *it_ sent so far
+   uint64_t have_;                    //!< bytes received not yet matched
+   uint64_t lastSend_;                //!< when this side last finished a
+                                      //!< message, 0 once answered
+};
+
+
+ReplayConn::ReplayConn( BinaryDataReader::iterator from, 
+                        BinaryDataReader::iterator to, TransferType mine,
+                        ReplayGroup& g )
+ : it_(from), end_(to), mine_(mine), g_(g), loop_(0), sent_(0), have_(0),
+   lastSend_(0)
+{
+   ++g_.conns;
+}
+
+
+ReplayConn::~ReplayConn()
+{
+   close();
+}
+
+
+//! @brief Starts playing over a connected socket.
+//!
+//! @param pS    the connection, which is taken over.
+//! @param loop  the EventLoop of the thread to play in.
+//! @returns 0, or -1 with errno set if it couldn't be watched.
+int ReplayConn::open( Socket* pS, EventLoop& loop )
+{
+   sock_.reset( pS );
+   int on = 1;
+   setsockopt( pS->getFD(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+   fcntl( pS->getFD(), F_SETFL, O_NONBLOCK );
+   if ( loop.add( pS->getFD(), EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                  boost::bind(&ReplayConn::onEvent, this, _1) ) == -1 )
+      return -1;
+   loop_ = &loop;
+   return 0;
+}
+
+
+void ReplayConn::onEvent( uint32_t events )
+{
+   if ( ! step() )
+      close();
+}
+
+
+//! @brief Plays on until the socket would block.
+//!
+//! Whatever the next record needs, a send or a receive, is tried straight
+//! away rather than waited for, so that no readiness is missed with the
+//! edge triggered EventLoop.
+//!
+//! @returns false once the file has been played, or the connection failed.
+bool ReplayConn::step()
+{
+   char buf[65536];
+   for( ;; ) {
+      if ( it_ == end_ )
+         return false;
+      if ( it_->type == mine_ ) {
+         ssize_t n = ::send( sock_->getFD(), it_->data + sent_, 
+                             it_->len - sent_, MSG_NOSIGNAL );
+         if ( n == -1 ) {
+            if ( errno == EINTR )
+               continue;
+            if ( errno != EAGAIN )
+               ++g_.failed;
+            return errno == EAGAIN;
+         }
+         sent_ += n;
+         g_.sent += n;
+         if ( sent_ == it_->len ) {
+            lastSend_ = monoNow();
+            sent_ = 0;
+            ++it_;
+         }
+      }
+      else if ( have_ >= it_->len ) {
+         have_ -= it_->len;
+         ++it_;
+         answered();
+      }
+      else {
+         ssize_t n = ::read( sock_->getFD(), buf, sizeof(buf) );
+         if ( n == -1 && errno == EINTR )
+            continue;
+         if ( n == -1 && errno == EAGAIN )
+            return true;
+         if ( n <= 0 ) {
+            ++g_.failed;
+            return false;
+         }
+         have_ += n;
+         g_.received += n;
+      }
+   }
+}
+
+
+//! Takes the time of an answer, once the other side's last record before
+//! this side's next one has been received.
+void ReplayConn::answered()
+{
+   if ( lastSend_ && (it_ == end_ || it_->type == mine_) ) {
+      g_.latency.record( monoNow() - lastSend_ );
+      ++g_.exchanges;
+      lastSend_ = 0;
+   }
+}
+
+
+void ReplayConn::close()
+{
+   if ( ! sock_ )
+      return;
+   if ( loop_ )
+      loop_->remove( sock_->getFD() );
+   sock_->close();
+   sock_.reset();
+}
+
+
+//! @brief A thread of a fanOut(): its connections and their EventLoop.
+struct ReplayWorker {
+   EventLoop loop;
+   std::vector<boost::shared_ptr<ReplayConn> > conns;
+   ReplayGroup group;
+
+   //! Plays until every connection is done with.
+   void run()
+   {
+      uint64_t begin = monoNow();
+      loop.run();
+      group.secs = (monoNow() - begin) / 1e9;
+   }
+};
+
+
+//! Prints the throughput and the answer times of a group of connections.
+static void printGroup( const std::string& name, const ReplayGroup& g )
+{
+   const Histogram& h = g.latency;
+   double secs = ( g.secs > 0 ) ? g.secs : 1e-9;
+   std::cerr << name << ": " << g.conns << " connections, " << g.failed 
+             << " failed, sent " << g.sent << " bytes, received " 
+             << g.received << " bytes in " << g.secs << " s, "
+             << g.sent / secs / 1e6 << " MB/s out, " 
+             << g.received / secs / 1e6 << " MB/s in\n"
+             << name << " latency (usec): " << h.count() 
+             << " answers, p50 " << h.percentile(50) / 1000.0
+             << ", p99 " << h.percentile(99) / 1000.0
+             << ", p99.9 " << h.percentile(99.9) / 1000.0
+             << ", max " << h.max() / 1000.0 << "\n";
+}
+
+
 //! @brief Player Constructor
 //!
 //! Instantiates a player instance by copying the configuration settings
@@ -16,7 +406,8 @@ using namespace ntee;
 //! @param cfg   The configuration settings.
 //!
 Player::Player( const Config& cfg )
- : cfg_(cfg)
+ : cfg_(cfg), started_(false), first_(0), start_(0),
+   expected_(0), received_(0), sent_(false)
 {
    //empty
 }
@@ -27,16 +418,22 @@ Player::Player( const Config& cfg )
 //! The player is a FSM with it first state being the connection details.
 //! When connection is complete the player moves into a broadcast state
 //! which start reading through the data file passing data over the 
-//! socket as distinct messages, and waiting when it encounters a message
-//! from the other side.
+//! socket as distinct messages, and waiting for the messages of the other
+//! side before it sends each of its own.
 //!
-//! @returns integer state value the machine reached. END state is zero.
+//! @returns 0 if the playback went through as recorded, -1 otherwise, as
+//!          the mode played in reports it.
 //!
 int Player::start()
 {
    // Open the file
    BinaryDataReader data;
    SysErrIf( data.open(cfg_.file) != 0 );
+   WarnIf( cfg_.speed > 0 && data.version() == 0 )
+      .info("%s has no record times, --speed is ignored\n", cfg_.file.c_str());
+   seek( data );
+   if ( cfg_.connections > 1 )
+      return fanOut( data );
    
    // Connect with the client (or server);
    Socket *pS;
@@ -44,9 +441,95 @@ int Player::start()
    boost::scoped_ptr<Socket> sock(pS);
    
    // Playback the data into the socket
-   playback( pS, data );
-   
-   return 0;
+   if ( cfg_.blast )
+      return blast( pS, data );
+   if ( cfg_.rate > 0 )
+      return openLoop( pS, data );
+   int rc = playback( pS, data );
+   report();
+   return rc;
+}
+
+
+//! @brief  Moves the reader to where the playback is to start.
+//!
+//! A time is counted from the first record of the file.  Both seeks go
+//! through the file's index, when it has one.  The program is terminated
+//! if the file ends before the starting point.
+//!
+//! @param data  Reference to the data source (the Reader) itself.
+//!
+void Player::seek( BinaryDataReader& data )
+{
+   if ( cfg_.fromTime > 0 ) {
+      RecordView first;
+      ErrIf( ! data.next( first ) ).info("%s has no records\n", cfg_.file.c_str());
+      uint64_t t = first.time + (uint64_t) (cfg_.fromTime * 1e9);
+      ErrIf( ! data.seekToTime( t ) )
+         .info("%s ends before %g secs\n", cfg_.file.c_str(), cfg_.fromTime);
+   }
+   else if ( cfg_.fromRecord > 0 ) {
+      ErrIf( ! data.seekToRecord( cfg_.fromRecord ) )
+         .info("%s has no record %llu\n", cfg_.file.c_str(), 
+               (unsigned long long) cfg_.fromRecord);
+   }
+}
+
+
+//! @brief  Holds a send back until its time in the recording.
+//!
+//! The schedule starts at the first record played, and each record is due
+//! its recorded distance from that one, divided by the speed.  How late
+//! the send is after waitUntil() is recorded in drift_.  Nothing is held
+//! back when no speed was given or the file has no times.
+//!
+//! @param time  recorded time of the record, as RecordView::time.
+//!
+void Player::pace( uint64_t time )
+{
+   if ( cfg_.speed <= 0 || time == 0 )
+      return;
+   if ( ! started_ ) {
+      started_ = true;
+      prctl( PR_SET_TIMERSLACK, 1UL );  // else sleeps run up to 50us over
+      first_ = time;
+      start_ = monoNow();
+   }
+   uint64_t due = start_ + (uint64_t) ((time - first_) / cfg_.speed);
+   drift_.record( waitUntil( due ) - due );
+}
+
+
+//! @brief  Moves the schedule on by however long a receive was late.
+//!
+//! A message from the other side is waited on for as long as it takes,
+//! and the records after it are then held to their recorded distance from
+//! it, rather than from the start, so that the other side being slow isn't
+//! counted as drift.
+//!
+//! @param time  recorded time of the record received.
+//!
+void Player::waited( uint64_t time )
+{
+   if ( ! started_ || time == 0 )
+      return;
+   uint64_t due = start_ + (uint64_t) ((time - first_) / cfg_.speed);
+   uint64_t now = monoNow();
+   if ( now > due )
+      start_ += now - due;
+}
+
+
+//! @brief  Prints how far behind schedule the sends were, when paced.
+void Player::report() const
+{
+   if ( drift_.count() == 0 )
+      return;
+   std::cerr << "Send drift (usec): " << drift_.count() 
+             << " sends, p50 " << drift_.percentile(50) / 1000.0
+             << ", p99 " << drift_.percentile(99) / 1000.0
+             << ", p99.9 " << drift_.percentile(99.9) / 1000.0
+             << ", max " << drift_.max() / 1000.0 << "\n";
 }
 
 
@@ -78,39 +561,330 @@ Socket* Player::connect()
 }
 
 
+//! @brief  Connects cfg_.connections times, or as a server waits for
+//!         that many clients.
+//!
+//! @param socks  set to the connections.
+//!
+void Player::connectAll( std::vector<Socket*>& socks )
+{
+   IPAddress ip( cfg_.host.c_str(), cfg_.port.c_str() );
+   if ( cfg_.type == Config::CLIENT ) {
+      while( socks.size() < cfg_.connections ) {
+         Socket* sock = new TCPSocket("Player");
+         SysErrIf( sock->connectTo(ip) == -1 )
+            .info("Connection %u of %u failed\n", (unsigned) socks.size() + 1,
+                  cfg_.connections);
+         socks.push_back( sock );
+      }
+   }
+   else {
+      TCPSocket listener("Player");
+      listener.listenOn(ip);
+      while( socks.size() < cfg_.connections )
+         socks.push_back( listener.accept("Cli") );
+      listener.close();
+   }
+}
+
+
+//! @brief  Play back the data over many connections at once.
+//!
+//! The connections are made first, then shared out between the threads,
+//! each of which plays its own with a ReplayConn apiece on an EventLoop of
+//! its own.  They all read the one mapping of the file.  Once the last
+//! connection is done with, the throughput and the answer times of each
+//! thread's group of connections are printed, and then the totals.
+//!
+//! @param data  Reference to the data source, already moved to where the
+//!              playback starts.
+//! @return 0 if every connection played the whole file, -1 otherwise.
+//!
+int Player::fanOut( const BinaryDataReader& data )
+{
+   TransferType buf_T = (cfg_.type == Config::CLIENT)?R_to_L:L_to_R;
+   unsigned threads = cfg_.threads;
+   if ( threads == 0 )
+      threads = std::max( boost::thread::hardware_concurrency(), 1U );
+   threads = std::min( threads, cfg_.connections );
+
+   std::vector<Socket*> socks;
+   connectAll( socks );
+
+   std::vector<boost::shared_ptr<ReplayWorker> > workers;
+   for( unsigned i=0; i < threads; ++i )
+      workers.push_back( boost::shared_ptr<ReplayWorker>( new ReplayWorker ) );
+   for( size_t i=0; i < socks.size(); ++i ) {
+      ReplayWorker& w = *workers[i % threads];
+      w.conns.push_back( boost::shared_ptr<ReplayConn>( 
+         new ReplayConn( data.position(), data.end(), buf_T, w.group ) ) );
+      SysErrIf( w.conns.back()->open( socks[i], w.loop ) == -1 );
+   }
+
+   boost::thread_group pool;
+   for( unsigned i=0; i < threads; ++i )
+      pool.create_thread( boost::bind(&ReplayWorker::run, workers[i].get()) );
+   pool.join_all();
+
+   ReplayGroup total;
+   for( unsigned i=0; i < threads; ++i ) {
+      std::ostringstream name;
+      name << "Group " << i;
+      printGroup( name.str(), workers[i]->group );
+      total += workers[i]->group;
+   }
+   printGroup( "Total", total );
+   return ( total.failed == 0 && data.good() )?0:-1;
+}
+
+
 //! @brief  Play back the data in the file
 //!
 //! Reads data from the data file, and sends it over the connected socket.
+//! Given a speed, each send is held to its time in the recording by pace().
+//! The other side's records are handed to a ReplyMatcher, and before each
+//! send the player receives until no more than cfg_.window of them are
+//! still to come, none at all by default.  Whatever has come in is
+//! checked against the recording byte for byte, however it was split.
 //! The method will return -1 if there is any problems sending the data.
 //! @param pS    pointer to Socket upon which to play data
 //! @param data  Reference to the data source (the Reader) itself.
-//! @return 0 if there were no error sending the data. -1 if something 
-//!         bad happened.
+//! @return 0 if there were no error sending the data and the other side
+//!         sent what was recorded. -1 if something bad happened.
 //!
 int Player::playback( Socket* pS, BinaryDataReader& data )
 {
    TransferType buf_T = (cfg_.type == Config::CLIENT)?R_to_L:L_to_R;
-   while ( pS->good() && data.good() && ! data.eof() ) {
-      Buffer* pB;
-      if ((pB = data.getNext()) != 0 ) {
-         if ( pB->type == buf_T ) {
-            // Got a buffer we're supposed to send...
-            pS->send( *pB );
-         }
-         else {
-            // Got a buffer we're supposed to recieve! See what we get?
-            Buffer* pBGot = pS->recv();
-            if ( pBGot->len != pB->len ) {
-               std::cerr << "Recieved a message of unmatching length: got=" << pBGot->len
-                         << " bytes, expected=" << pB->len << " bytes.\n";
-            }
-            delete pBGot;
-         }  
-         delete pB;
+   ReplyMatcher replies;
+   bool ok = true;
+   RecordView rec;
+   while ( ok && pS->good() && data.next( rec ) ) {
+      if ( rec.type == buf_T ) {
+         // Got a buffer we're supposed to send, straight from the file...
+         while ( ok && replies.outstanding() > cfg_.window )
+            ok = receive( pS, replies );
+         if ( ! ok )
+            break;
+         pace( rec.time );
+         Buffer out( buf_T, false );
+         out.buf = rec.data;
+         out.len = rec.len;
+         pS->send( out );
       }
+      else
+         replies.expect( rec );
    }
-   return (pS->good() && data.eof())?0:-1;
+   while ( ok && replies.outstanding() > 0 )
+      ok = receive( pS, replies );
+
+   WarnIf( replies.differ() > 0 )
+      .info("%llu messages from the other side differ from the recording\n",
+            (unsigned long long) replies.differ());
+   WarnIf( replies.extra() > 0 )
+      .info("%llu bytes more came from the other side than were recorded\n",
+            (unsigned long long) replies.extra());
+   return (ok && pS->good() && data.good() && data.eof() 
+           && replies.differ() == 0)?0:-1;
+}
+
+
+//! @brief  Receives once from the other side, and matches what came.
+//!
+//! @param pS       pointer to Socket to read from
+//! @param replies  the other side's records awaited.
+//! @returns false if the connection was closed first.
+//!
+bool Player::receive( Socket* pS, ReplyMatcher& replies )
+{
+   BufferPtr pBGot = pS->recv();
+   if ( pBGot == 0 ) {
+      std::cerr << "Connection closed while expecting " << replies.owed()
+                << " bytes.\n";
+      return false;
+   }
+   if ( replies.feed( pBGot->buf, pBGot->size() ) > 0 )
+      waited( replies.lastTime() );
+   return true;
 }
 
 
    
+
+
+//! @brief  Play back this side's data as fast as the socket takes it.
+//!
+//! The other side's messages aren't waited for.  A drain() thread reads
+//! them as they come, and since the byte stream doesn't keep the recorded
+//! message boundaries, only the total of their bytes is checked against
+//! the file once everything has been sent.  The rate of sending and the
+//! bytes received are reported at the end.
+//!
+//! @param pS    pointer to Socket upon which to play data
+//! @param data  Reference to the data source (the Reader) itself.
+//! @return 0 if everything was sent and the other side sent as much as
+//!         was recorded, -1 otherwise.
+//!
+int Player::blast( Socket* pS, BinaryDataReader& data )
+{
+   TransferType buf_T = (cfg_.type == Config::CLIENT)?R_to_L:L_to_R;
+   boost::thread receiver( boost::bind(&Player::drain, this, pS) );
+
+   uint64_t messages = 0, bytes = 0, begin = monoNow();
+   bool ok = true;
+   int err = 0;
+   RecordView rec;
+   while ( ok && data.next( rec ) ) {
+      if ( rec.type == buf_T ) {
+         Buffer out( buf_T, false );
+         out.buf = rec.data;
+         out.len = rec.len;
+         ok = ( pS->send( out ) == (int) rec.len );
+         err = errno;
+         ++messages;
+         bytes += rec.len;
+      }
+      else {
+         boost::lock_guard<boost::mutex> lock( mutex_ );
+         expected_ += rec.len;
+      }
+   }
+   double secs = (monoNow() - begin) / 1e9;
+   finishDrain( pS, receiver, ok );
+
+   std::cerr << "Blast: sent " << messages << " messages, " << bytes
+             << " bytes in " << secs << " s, " 
+             << ( secs > 0 ? bytes / secs / 1e6 : 0 ) << " MB/s\n"
+             << "Blast: received " << received_ << " of " << expected_ 
+             << " bytes expected\n";
+   WarnIf( ! ok ).info("Sending stopped short: %s\n", strerror(err));
+   return ( ok && data.good() && received_ == expected_ )?0:-1;
+}
+
+
+//! @brief  Plays back this side's records at a fixed rate, whether the
+//!         other side has answered or not.
+//!
+//! Record i of this side is due i / cfg_.rate secs after the first, and is
+//! sent then, or straight away if sending has fallen behind.  The other
+//! side's records up to this side's next one are its answer.  A drain()
+//! thread reads the answers as they come, and takes the time of each from
+//! when its request was due rather than when it was sent, so that the
+//! server stalling the player, by not answering or by filling the socket,
+//! can't leave the wait out of the latency.  Its percentiles are printed
+//! at the end with the rate reached.
+//!
+//! @param pS    pointer to Socket upon which to play data
+//! @param data  Reference to the data source, already moved to where the
+//!              playback starts.
+//! @return 0 if everything was sent and the other side sent as much as
+//!         was recorded, -1 otherwise.
+//!
+int Player::openLoop( Socket* pS, BinaryDataReader& data )
+{
+   TransferType buf_T = (cfg_.type == Config::CLIENT)?R_to_L:L_to_R;
+   prctl( PR_SET_TIMERSLACK, 1UL );
+   boost::thread receiver( boost::bind(&Player::drain, this, pS) );
+
+   uint64_t requests = 0, late = 0, begin = monoNow();
+   bool ok = true;
+   int err = 0;
+   BinaryDataReader::iterator it = data.position(), end = data.end();
+   while( ok && it != end ) {
+      if ( it->type != buf_T ) {
+         // Answers before the first request of the playback
+         boost::lock_guard<boost::mutex> lock( mutex_ );
+         expected_ += (it++)->len;
+         continue;
+      }
+      // A copy, the iterator's view is overwritten as the answer is summed
+      RecordView rec = *it;
+      uint64_t answer = 0;
+      for( ++it; it != end && it->type != buf_T; ++it )
+         answer += it->len;
+
+      // Owed its answer before it is sent, the answer may be quick
+      uint64_t due = begin + (uint64_t) (requests * 1e9 / cfg_.rate);
+      if ( answer > 0 ) {
+         boost::lock_guard<boost::mutex> lock( mutex_ );
+         expected_ += answer;
+         pending_.push_back( Pending_t( expected_, due ) );
+      }
+      if ( waitUntil( due ) - due > SPIN_NSEC )
+         ++late;
+      Buffer out( buf_T, false );
+      out.buf = rec.data;
+      out.len = rec.len;
+      ok = ( pS->send( out ) == (int) rec.len );
+      err = errno;
+      ++requests;
+   }
+   double secs = (monoNow() - begin) / 1e9;
+   finishDrain( pS, receiver, ok );
+
+   std::cerr << "Open loop: sent " << requests << " requests in " << secs
+             << " s, " << ( secs > 0 ? requests / secs : 0 ) << " per sec of "
+             << cfg_.rate << " wanted, " << late << " late\n"
+             << "Open loop: received " << received_ << " of " << expected_ 
+             << " bytes expected\n"
+             << "Open loop latency (usec): " << latency_.count() 
+             << " answers, p50 " << latency_.percentile(50) / 1000.0
+             << ", p90 " << latency_.percentile(90) / 1000.0
+             << ", p99 " << latency_.percentile(99) / 1000.0
+             << ", p99.9 " << latency_.percentile(99.9) / 1000.0
+             << ", p99.99 " << latency_.percentile(99.99) / 1000.0
+             << ", max " << latency_.max() / 1000.0 << "\n";
+   WarnIf( ! pending_.empty() )
+      .info("%u requests were never answered in full\n", 
+            (unsigned) pending_.size());
+   WarnIf( ! ok ).info("Sending stopped short: %s\n", strerror(err));
+   return ( ok && data.good() && received_ == expected_ )?0:-1;
+}
+
+
+//! @brief  Lets the drain() thread finish once everything has been sent.
+//!
+//! It is woken, if it already has all it is going to get, by shutting
+//! the socket down for reading.
+//!
+//! @param pS        Socket the thread reads
+//! @param receiver  the thread
+//! @param ok        false if sending failed, and no more is to be waited for
+//!
+void Player::finishDrain( Socket* pS, boost::thread& receiver, bool ok )
+{
+   {
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      sent_ = true;
+      if ( ! ok || received_ >= expected_ )
+         shutdown( pS->getFD(), SHUT_RD );
+   }
+   receiver.join();
+}
+
+
+//! @brief  Counts what the other side sends during a blast() or an
+//!         openLoop(), until it has sent all it was recorded to, or
+//!         closes.
+//!
+//! The answers pending_ once their last byte is in are timed into
+//! latency_.
+//!
+//! @param pS    pointer to Socket to read from
+//!
+void Player::drain( Socket* pS )
+{
+   BufferPtr pB;
+   while( (pB = pS->recv()) != 0 ) {
+      uint64_t now = monoNow();
+      boost::lock_guard<boost::mutex> lock( mutex_ );
+      received_ += pB->size();
+      while( ! pending_.empty() && pending_.front().first <= received_ ) {
+         // Answered ahead of time, it took no time at all
+         uint64_t due = pending_.front().second;
+         latency_.record( now > due ? now - due : 0 );
+         pending_.pop_front();
+      }
+      if ( sent_ && received_ >= expected_ )
+         break;
+   }
+}
@@ -2,11 +2,19 @@
 #define INCLUDED_PLAYER_HPP
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdint.h>
+#include "Histogram.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 namespace ntee {
    class Socket;
    class BinaryDataReader;
 }
+class ReplyMatcher;
 
 //! The Player class reads ntee output files and pushes data out
 //! over a socket.  Acting like the server.
@@ -21,6 +29,17 @@ public:
       std::string host;
       std::string port;
       std::string file;
+      uint64_t fromRecord;   //!< record to start at, from 0
+      double fromTime;       //!< or secs after the first record to start at
+      double speed;          //!< multiple of the recorded pace to send at,
+                             //!< 0 to send back to back
+      bool blast;            //!< send without waiting on the other side
+      unsigned connections;  //!< connections to play the file over at once
+      unsigned threads;      //!< threads to share them, 0 for one a core
+      double rate;           //!< requests a sec to send at, open loop,
+                             //!< 0 to wait for answers
+      unsigned window;       //!< other side's messages which may still be
+                             //!< awaited when this side sends
    };
 
    //! Instantiates and configures a player
@@ -32,10 +51,35 @@ public:
 private:
 
    int playback( ntee::Socket*, ntee::BinaryDataReader& );
+   bool receive( ntee::Socket*, ReplyMatcher& );
+   int blast( ntee::Socket*, ntee::BinaryDataReader& );
+   int openLoop( ntee::Socket*, ntee::BinaryDataReader& );
+   void drain( ntee::Socket* );
+   void finishDrain( ntee::Socket*, boost::thread&, bool ok );
+   int fanOut( const ntee::BinaryDataReader& );
+   void connectAll( std::vector<ntee::Socket*>& );
+   void seek( ntee::BinaryDataReader& );
+   void pace( uint64_t time );
+   void waited( uint64_t time );
+   void report() const;
    ntee::Socket* connect();
    
    Config cfg_;
-         
+   bool started_;          //!< the schedule has been set
+   uint64_t first_;        //!< recorded time the schedule starts from
+   uint64_t start_;        //!< CLOCK_MONOTONIC nsec it is played from
+   ntee::Histogram drift_; //!< nsec each send was behind schedule
+
+   //! An answer awaited: where its last byte is, and when it was due.
+   typedef std::pair<uint64_t, uint64_t> Pending_t;
+
+   // Shared by blast(), openLoop() and the drain() thread
+   boost::mutex mutex_;    //!< guards everything below
+   uint64_t expected_;     //!< bytes of the other side's records so far
+   uint64_t received_;     //!< bytes received from the other side
+   bool sent_;             //!< every record has been gone through
+   std::deque<Pending_t> pending_;  //!< answers awaited, oldest first
+   ntee::Histogram latency_;        //!< nsec from due to answered
 };
 
 #endif
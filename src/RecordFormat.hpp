@@ -0,0 +1,173 @@
+#ifndef INCLUDED_RECORDFORMAT_HPP
+#define INCLUDED_RECORDFORMAT_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+namespace ntee {
+
+//! @brief Layout of the binary data files written by the
+//!        BinaryDataRecorder.
+//!
+//! A file starts with a FileHeader, followed by records, each a
+//! RecordHeader and then the payload.  Every field is little-endian, and
+//! the headers are always their full size so that later versions can only
+//! add to the end of them.
+//!
+//! Beside the file, in <file>.idx, is a sparse index of it: a header of
+//! INDEX_MAGIC and the version, and then an IndexEntry for the first
+//! record and every INDEX_RECORDS records or INDEX_BYTES of file after,
+//! whichever comes first.
+//!
+//! The first files had no file header, and records of a 1-byte
+//! destination ('L' or 'R') and a big-endian 4-byte length.  Those are
+//! version 0; the BinaryDataReader still reads them.
+namespace RecordFormat {
+
+//! First bytes of every versioned file.
+static const char MAGIC[8] = { 'N', 'T', 'E', 'E', 'B', 'D', 'R', '\0' };
+
+//! Version written by the recorder.
+static const uint16_t VERSION = 1;
+
+//! Length in bytes of the file header.
+static const size_t FILE_HEADER_LEN = 24;
+
+//! Length in bytes of the record header.
+static const size_t RECORD_HEADER_LEN = 32;
+
+//! Length in bytes of the version 0 record header.
+static const size_t V0_HEADER_LEN = 5;
+
+
+//! @brief Start of the file.
+//!
+//!   0  magic[8]
+//!   8  version           u16
+//!  10  record header len u16
+//!  12  reserved          u32
+//!  16  realtime offset   i64, CLOCK_REALTIME - CLOCK_MONOTONIC in nsec
+//!                        when the file was opened
+struct FileHeader {
+   uint16_t version;
+   uint16_t recordLen;
+   int64_t realtimeOffset;
+
+   void put( char* p ) const {
+      uint16_t v = htole16( version ), r = htole16( recordLen );
+      uint32_t z = 0;
+      uint64_t o = htole64( (uint64_t) realtimeOffset );
+      memcpy( p, MAGIC, sizeof(MAGIC) );
+      memcpy( p + 8, &v, 2 );
+      memcpy( p + 10, &r, 2 );
+      memcpy( p + 12, &z, 4 );
+      memcpy( p + 16, &o, 8 );
+   }
+
+   //! @returns false if p doesn't hold a file header.
+   bool get( const char* p, size_t n ) {
+      if ( n < FILE_HEADER_LEN || memcmp( p, MAGIC, sizeof(MAGIC) ) )
+         return false;
+      uint16_t v, r;
+      uint64_t o;
+      memcpy( &v, p + 8, 2 );
+      memcpy( &r, p + 10, 2 );
+      memcpy( &o, p + 16, 8 );
+      version = le16toh( v );
+      recordLen = le16toh( r );
+      realtimeOffset = (int64_t) le64toh( o );
+      return true;
+   }
+};
+
+
+//! @brief Start of each record.
+//!
+//!   0  time        u64, CLOCK_MONOTONIC in nsec when the message was read
+//!   8  sequence    u64, number of the record in its direction, from 0
+//!  16  session     u32
+//!  20  length      u32, of the payload which follows
+//!  24  destination u8, 'L' or 'R'
+//!  25  reserved[7]
+struct RecordHeader {
+   uint64_t time;
+   uint64_t seq;
+   uint32_t session;
+   uint32_t len;
+   char dest;
+
+   void put( char* p ) const {
+      uint64_t t = htole64( time ), s = htole64( seq );
+      uint32_t id = htole32( session ), l = htole32( len );
+      memcpy( p, &t, 8 );
+      memcpy( p + 8, &s, 8 );
+      memcpy( p + 16, &id, 4 );
+      memcpy( p + 20, &l, 4 );
+      memset( p + 24, 0, 8 );
+      p[24] = dest;
+   }
+
+   void get( const char* p ) {
+      memcpy( &time, p, 8 );
+      memcpy( &seq, p + 8, 8 );
+      memcpy( &session, p + 16, 4 );
+      memcpy( &len, p + 20, 4 );
+      time = le64toh( time );
+      seq = le64toh( seq );
+      session = le32toh( session );
+      len = le32toh( len );
+      dest = p[24];
+   }
+};
+
+
+//! First bytes of an index file.
+static const char INDEX_MAGIC[8] = { 'N', 'T', 'E', 'E', 'I', 'D', 'X', '\0' };
+
+//! Length in bytes of the index file header: magic[8], version u16 and
+//! reserved[6].
+static const size_t INDEX_HEADER_LEN = 16;
+
+//! Length in bytes of an index entry.
+static const size_t INDEX_ENTRY_LEN = 24;
+
+//! Most records between index entries.
+static const uint64_t INDEX_RECORDS = 1024;
+
+//! Most bytes of file between index entries.
+static const uint64_t INDEX_BYTES = 1024*1024;
+
+
+//! @brief Where a record is.
+//!
+//!   0  record number u64, from 0
+//!   8  time          u64, of the record
+//!  16  offset        u64, of the record header in the file
+struct IndexEntry {
+   uint64_t record;
+   uint64_t time;
+   uint64_t offset;
+
+   void put( char* p ) const {
+      uint64_t r = htole64( record ), t = htole64( time ), o = htole64( offset );
+      memcpy( p, &r, 8 );
+      memcpy( p + 8, &t, 8 );
+      memcpy( p + 16, &o, 8 );
+   }
+
+   void get( const char* p ) {
+      memcpy( &record, p, 8 );
+      memcpy( &time, p + 8, 8 );
+      memcpy( &offset, p + 16, 8 );
+      record = le64toh( record );
+      time = le64toh( time );
+      offset = le64toh( offset );
+   }
+};
+
+} // end namespace RecordFormat
+
+} // end namespace ntee
+
+#endif
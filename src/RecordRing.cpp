@@ -0,0 +1,89 @@
+#include "RecordRing.hpp"
+#include "Buffer.hpp"
+
+namespace ntee {
+
+//! @brief Creates an empty ring.
+//! @param capacity   Requested number of slots, rounded up to a power of 2.
+RecordRing::RecordRing( size_t capacity )
+ : slots_(0), mask_(0), head_(0), tail_(0)
+{
+   size_t n = 1;
+   while( n < capacity )
+      n <<= 1;
+   mask_ = n - 1;
+   slots_ = new boost::atomic<Buffer*>[n];
+   for( size_t i=0; i < n; ++i )
+      slots_[i].store( 0, boost::memory_order_relaxed );
+}
+
+
+//! Releases any Buffers which were never consumed.
+RecordRing::~RecordRing()
+{
+   Buffer* b;
+   while( (b=take()) != 0 )
+      intrusive_ptr_release( b );
+   delete [] slots_;
+}
+
+
+//! @brief Producer side.  Appends a Buffer to the ring.
+//! @returns false, leaving ownership with the caller, if the ring is full.
+bool RecordRing::push( Buffer* b )
+{
+   uint64_t h = head_.load( boost::memory_order_relaxed );
+   if ( h - tail_.load( boost::memory_order_acquire ) > mask_ )
+      return false;
+   slots_[h & mask_].store( b, boost::memory_order_relaxed );
+   head_.store( h+1, boost::memory_order_release );
+   return true;
+}
+
+
+//! @brief Consumer side.  Takes the oldest Buffer out of the ring.
+//! @returns the Buffer, now owned by the caller, or NULL if empty.
+Buffer* RecordRing::pop()
+{
+   return take();
+}
+
+
+//! @brief Producer side.  Takes the oldest Buffer out of the ring so that a
+//!        newer one fits; used to implement the drop-oldest policy.
+//! @returns the Buffer, now owned by the caller, or NULL if the consumer
+//!          emptied the ring in the meantime.
+Buffer* RecordRing::evict()
+{
+   return take();
+}
+
+
+//! @returns the number of Buffers waiting in the ring.
+size_t RecordRing::size() const
+{
+   uint64_t t = tail_.load( boost::memory_order_acquire );
+   return head_.load( boost::memory_order_acquire ) - t;
+}
+
+
+//! @brief Claims the slot at the read index.
+//!
+//! The slot is read before the index is advanced.  A successful swap
+//! proves the index never moved in between, and the producer does not
+//! reuse a slot until the index has passed it, so the value read is the
+//! one which was claimed.
+Buffer* RecordRing::take()
+{
+   uint64_t t = tail_.load( boost::memory_order_acquire );
+   for( ;; ) {
+      if ( t == head_.load( boost::memory_order_acquire ) )
+         return 0;
+      Buffer* b = slots_[t & mask_].load( boost::memory_order_relaxed );
+      if ( tail_.compare_exchange_weak( t, t+1, boost::memory_order_acq_rel,
+                                        boost::memory_order_acquire ) )
+         return b;
+   }
+}
+
+} // end namespace ntee
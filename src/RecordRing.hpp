@@ -0,0 +1,50 @@
+#ifndef INCLUDED_RECORDRING_HPP
+#define INCLUDED_RECORDRING_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include <boost/atomic.hpp>
+
+namespace ntee {
+
+struct Buffer;
+
+//! @brief Bounded, lock-free, single producer / single consumer ring of
+//!        Buffer pointers.
+//!
+//! The relay thread is the only producer and a recorder thread the only
+//! consumer.  The consumer claims a slot by advancing the read index with
+//! a compare-and-swap, which also lets the producer throw away the oldest
+//! entry (evict()) when the ring is full without any lock: whichever of
+//! the two wins the swap owns the Buffer.  Each pointer in the ring
+//! carries one reference on its Buffer, which passes to whoever takes it
+//! out again.
+class RecordRing {
+public:
+   explicit RecordRing( size_t capacity );
+   ~RecordRing();
+
+   bool push( Buffer* b );
+   Buffer* pop();
+   Buffer* evict();
+
+   size_t size() const;
+
+   //! @returns the number of Buffers the ring can hold.
+   size_t capacity() const { return mask_ + 1; }
+
+private:
+   RecordRing( const RecordRing& );
+   RecordRing& operator=( const RecordRing& );
+
+   Buffer* take();
+
+   boost::atomic<Buffer*>* slots_;   //!< capacity() slots
+   size_t mask_;                     //!< capacity()-1, capacity is 2^n
+   boost::atomic<uint64_t> head_;    //!< next slot to write, producer only
+   boost::atomic<uint64_t> tail_;    //!< next slot to read
+};
+
+} // end namespace ntee
+
+#endif
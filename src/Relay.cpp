@@ -0,0 +1,548 @@
+#include "Relay.hpp"
+#include "NTee.hpp"
+#include "Socket.hpp"
+#include "Settings.hpp"
+#include "Error.hpp"
+#include "BufferPool.hpp"
+#include "comm.hpp"
+#include <errno.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <boost/bind.hpp>
+
+namespace ntee {
+
+//! Pipe capacity asked of the kernel for the zero copy path.  The kernel
+//! may round it, or refuse it, so the real size is read back.
+static const int PIPE_SIZE = 256*1024;
+
+
+//! @brief Makes a non-blocking pipe of (about) PIPE_SIZE bytes.
+//! @returns the pipe capacity in bytes, or 0 if the pipe couldn't be made.
+static size_t mkPipe( int fds[2] )
+{
+   if ( pipe2( fds, O_NONBLOCK|O_CLOEXEC ) == -1 ) {
+      fds[0] = fds[1] = -1;
+      return 0;
+   }
+   fcntl( fds[1], F_SETPIPE_SZ, PIPE_SIZE );
+   int sz = fcntl( fds[1], F_GETPIPE_SZ );
+   return ( sz > 0 )?sz:0;
+}
+
+
+//! @returns the time in nsec since a CLOCK_MONOTONIC time stamp.
+static uint64_t nsecSince( const timespec& then )
+{
+   timespec now;
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   return (now.tv_sec - then.tv_sec) * 1000000000ULL 
+          + now.tv_nsec - then.tv_nsec;
+}
+
+
+//! Adds another Relay's counters into these.  The queue depths are summed,
+//! so peakQueued of a sum is only an upper bound of the true peak.
+RelayStats& RelayStats::operator+=( const RelayStats& o )
+{
+   bytes += o.bytes;
+   queued += o.queued;
+   peakQueued += o.peakQueued;
+   stalls += o.stalls;
+   stallNsec += o.stallNsec;
+   dropped += o.dropped;
+   reads.calls += o.reads.calls;
+   reads.again += o.reads.again;
+   writes.calls += o.writes.calls;
+   writes.again += o.writes.again;
+   latency += o.latency;
+   return *this;
+}
+
+
+//! @brief Creates a one way relay.
+//!
+//! If the settings ask for zero copy, the forwarding and recording pipes
+//! are made here.  Should that fail, the relay quietly falls back to
+//! copying through user space.
+//!
+//! @param owner    The NTee instance whose recorders get a copy of the data.
+//! @param session  Id of the Session this relay belongs to.
+//! @param type     Direction, L_to_R or R_to_L.
+//! @param from     Socket to read from.
+//! @param to       Socket to write to.
+Relay::Relay( NTee& owner, unsigned int session, TransferType type,
+              Socket& from, Socket& to )
+ : owner_(owner), session_(session), type_(type),
+   from_(from), to_(to), eof_(false),
+   sent_(0), hangup_(false), paused_(false),
+   ring_(0), recvOp_(0), sendOp_(0),
+   pipeSize_(0), pending_(0), srcDone_(false)
+{
+   pipe_[0] = pipe_[1] = tee_[0] = tee_[1] = -1;
+   if ( owner_.s_.zero_copy ) {
+      size_t fwd = mkPipe( pipe_ );
+      size_t rec = mkPipe( tee_ );
+      WarnIf( fwd == 0 || rec == 0 ).info("Unable to make splice pipes, "
+                                          "copying instead\n");
+      if ( fwd == 0 || rec == 0 ) {
+         for( int i=0; i < 2; ++i ) {
+            if ( pipe_[i] != -1 ) ::close( pipe_[i] );
+            if ( tee_[i] != -1 ) ::close( tee_[i] );
+            pipe_[i] = tee_[i] = -1;
+         }
+      }
+      else {
+         // tee() can only copy what fits in the recording pipe.
+         pipeSize_ = std::min( fwd, rec );
+      }
+   }
+}
+
+
+//! Closes the pipes, if any.
+Relay::~Relay()
+{
+   halt();
+   for( int i=0; i < 2; ++i ) {
+      if ( pipe_[i] != -1 ) ::close( pipe_[i] );
+      if ( tee_[i] != -1 ) ::close( tee_[i] );
+   }
+}
+
+
+//! @brief Called by the event loop when the from socket is readable.
+//! @param events  The epoll event mask that fired.
+void Relay::onReadable( uint32_t events )
+{
+   if ( pipe_[0] == -1 )
+      copy( events );
+   else
+      pump();
+}
+
+
+//! @brief Called by the event loop when the to socket is writable.
+//!
+//! Writes out what is waiting.  If reading had been paused it is resumed
+//! once there is room again: the edge which announced the data that has
+//! been waiting on the from socket is long gone, so nobody else will.
+void Relay::onWritable()
+{
+   if ( pipe_[0] == -1 ) {
+      if ( queue_.empty() )
+         return;
+      flush();
+      if ( paused_ && stats_.queued <= owner_.s_.queue_low ) {
+         unstall();
+         copy( 0 );
+      }
+      else if ( srcDone_ && queue_.empty() )
+         eof_ = true;
+   }
+   else if ( pending_ > 0 && drainPipe() ) {
+      unstall();
+      pump();
+   }
+}
+
+
+//! @brief Read N, then Write it.
+//!
+//! Because the socket is registered edge-triggered, the whole of what is
+//! available is read before returning, unless the outbound queue fills
+//! up first.  Data is read with readv() into a chain of pooled segments,
+//! at most the read budget at a time, so a big burst never costs more
+//! memory than that.  Each chain read is queued, written out to the other
+//! side as far as it will go, and handed to the recorders, which keep a
+//! reference rather than a copy.
+//!
+//! End of file is only trusted when the kernel says so through the event
+//! mask, since an edge may wake us up with nothing left to read.  A hang
+//! up seen while paused is remembered until reading resumes.
+//!
+//! @param events  The epoll event mask that fired.
+//!
+void Relay::copy( uint32_t events )
+{
+   if ( events & (EPOLLRDHUP|EPOLLHUP|EPOLLERR) )
+      hangup_ = true;
+
+   const size_t budget = owner_.s_.read_budget;
+   while( ! srcDone_ ) {
+      if ( paused_ || stats_.queued >= owner_.s_.queue_high ) {
+         stall();
+         return;     // onWritable() carries on below the low water mark
+      }
+
+      BufferPtr head;
+      size_t len = read_chain( from_.getFD(), head, budget,
+                               &stats_.reads );
+      if ( len == (size_t) -1 ) {
+         srcDone_ = true;
+         break;
+      }
+
+      if ( len > 0 ) {
+         queue_.push_back( head );
+         queued( len );
+         flush();
+         record( *head );
+      }
+
+      if ( len < budget ) {
+         if ( hangup_ )
+            srcDone_ = true;
+         break;      // drained
+      }
+   }
+
+   if ( srcDone_ && queue_.empty() )
+      eof_ = true;
+}
+
+
+//! @brief Writes the outbound queue to the to socket.
+//!
+//! @returns true once the queue is empty, false if the to socket would
+//!          block.  An error on the to socket ends the relay, and whatever
+//!          is queued is dropped.
+bool Relay::flush()
+{
+   while( ! queue_.empty() ) {
+      const Buffer& head = *queue_.front();
+      size_t n = write_chain( to_.getFD(), head, sent_, &stats_.writes );
+      if ( n == (size_t) -1 ) {
+         queue_.clear();
+         sent_ = 0;
+         stats_.queued = 0;
+         srcDone_ = true;
+         eof_ = true;
+         return true;
+      }
+
+      sent_ += n;
+      stats_.queued -= n;
+      stats_.bytes += n;
+      if ( sent_ < head.size() )
+         return false;
+      stats_.latency.record( head.age() );
+      queue_.pop_front();
+      sent_ = 0;
+   }
+   return true;
+}
+
+
+//! @brief Moves data from socket to socket through the kernel.
+//!
+//! Splices a pipe full from the from socket, tees it for the recorders,
+//! and splices it on to the to socket.  This repeats until the from socket
+//! would block, or until the to socket can't take everything in the pipe.
+//! In the latter case reading stops until onWritable() empties the pipe.
+//! This is also what keeps tee() honest: it always copies from the head of
+//! the pipe, so the pipe must only ever hold the newest chunk.
+void Relay::pump()
+{
+   while( pending_ == 0 && ! srcDone_ ) {
+      ssize_t n = splice( from_.getFD(), 0, pipe_[1], 0, pipeSize_,
+                          SPLICE_F_MOVE|SPLICE_F_NONBLOCK );
+      ++stats_.reads.calls;
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         if ( errno == EAGAIN )
+            ++stats_.reads.again;
+         else
+            srcDone_ = true;    // reset or similar, treat as a hangup.
+         break;
+      }
+      if ( n == 0 ) {
+         srcDone_ = true;       // EOF
+         break;
+      }
+
+      pending_ = n;
+      clock_gettime( CLOCK_MONOTONIC, &pipeTs_ );
+      queued( n );
+      if ( ! owner_.recorders_.empty() )
+         recordPipe( n );
+      if ( ! drainPipe() )
+         stall();
+   }
+
+   if ( srcDone_ && pending_ == 0 )
+      eof_ = true;
+}
+
+
+//! @brief Splices the forwarding pipe out to the to socket.
+//!
+//! @returns true once the pipe is empty, false if the to socket would
+//!          block.  An error on the to socket ends the relay, and whatever
+//!          is in the pipe is dropped.
+bool Relay::drainPipe()
+{
+   while( pending_ > 0 ) {
+      ssize_t n = splice( pipe_[0], 0, to_.getFD(), 0, pending_,
+                          SPLICE_F_MOVE|SPLICE_F_NONBLOCK );
+      ++stats_.writes.calls;
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         if ( errno == EAGAIN ) {
+            ++stats_.writes.again;
+            return false;
+         }
+         pending_ = 0;
+         stats_.queued = 0;
+         srcDone_ = true;
+         eof_ = true;
+         return true;
+      }
+      pending_ -= n;
+      stats_.queued -= n;
+      stats_.bytes += n;
+   }
+   stats_.latency.record( nsecSince( pipeTs_ ) );
+   return true;
+}
+
+
+//! @brief Hands the chunk just spliced into the pipe to the recorders.
+//!
+//! The chunk is duplicated into the recording pipe with tee(), which
+//! leaves the forwarding pipe untouched, and then read out of it into a
+//! chain of pooled segments.
+//!
+//! @param len   Number of bytes in the forwarding pipe.
+void Relay::recordPipe( size_t len )
+{
+   ssize_t n;
+   while( (n=tee( pipe_[0], tee_[1], len, SPLICE_F_NONBLOCK )) == -1
+          && errno == EINTR ) {
+      /* try again */
+   }
+   if ( n <= 0 )
+      return;
+
+   BufferPtr head;
+   size_t got = read_chain( tee_[0], head, n );
+   if ( got == (size_t) -1 || got == 0 )
+      return;
+   record( *head );
+}
+
+
+//! @brief Runs the relay on the io_uring engine.
+//!
+//! Submission entries are queued here, it is up to the caller to have
+//! the ring submit them.
+//!
+//! @param ring   The engine.
+//! @param done   Called once eof() has become true.
+void Relay::start( Uring& ring, const boost::function<void ()>& done )
+{
+   ring_ = &ring;
+   done_ = done;
+   recvOp_ = ring.newOp( boost::bind(&Relay::received, this, _1) );
+   sendOp_ = ring.newOp( boost::bind(&Relay::sent, this, _1) );
+   postRecv();
+}
+
+
+//! @brief Lets go of the io_uring operations, cancelling any in flight.
+//!
+//! Must be called before the sockets are closed.  Safe to call more than
+//! once, and from within a completion.
+void Relay::halt()
+{
+   if ( ! ring_ )
+      return;
+   ring_->release( recvOp_ );
+   ring_->release( sendOp_ );
+   ring_ = 0;
+}
+
+
+//! @brief Reads no more from the from socket, and only writes out what
+//!        was read from it already.
+//!
+//! eof() becomes true once that is done, right away if nothing is
+//! waiting.  On io_uring a read in flight is cancelled, and finishes the
+//! relay, through done, when it completes.
+void Relay::stopReading()
+{
+   if ( srcDone_ )
+      return;
+   srcDone_ = true;
+   unstall();
+   if ( ring_ && recvOp_->busy )
+      ring_->cancel( recvOp_ );
+   else if ( queue_.empty() && pending_ == 0 )
+      eof_ = true;
+}
+
+
+//! Submits a read of the from socket into a fresh pooled Buffer.
+void Relay::postRecv()
+{
+   recvBuf_ = BufferPool::instance().acquire();
+   ++stats_.reads.calls;
+   if ( ! ring_->read( recvOp_, from_.getFD(), recvBuf_ ) ) {
+      recvBuf_.reset();
+      srcDone_ = true;     // no room in the ring, give up on the source.
+   }
+}
+
+
+//! Submits a write of what is left of the Buffer at the head of the queue.
+void Relay::postSend()
+{
+   ++stats_.writes.calls;
+   if ( ! ring_->write( sendOp_, to_.getFD(), queue_.front(), sent_ ) ) {
+      queue_.clear();
+      sent_ = 0;
+      stats_.queued = 0;
+      srcDone_ = true;
+   }
+}
+
+
+//! @brief Completion of a read of the from socket.
+//!
+//! The data is queued and recorded, and the next read is submitted unless
+//! the queue has reached the high water mark.
+//!
+//! @param res   Bytes read, 0 at end of file, or -errno.
+void Relay::received( int res )
+{
+   if ( ( res == -EINTR || res == -EAGAIN ) && ! srcDone_ ) {
+      if ( res == -EAGAIN )
+         ++stats_.reads.again;
+      postRecv();
+      return;
+   }
+   BufferPtr b;
+   b.swap( recvBuf_ );
+   if ( res <= 0 ) {
+      srcDone_ = true;
+      finish();
+      return;
+   }
+
+   b->len = res;
+   b->setTime();
+   queue_.push_back( b );
+   queued( res );
+   if ( ! sendOp_->busy )
+      postSend();
+   record( *b );
+
+   if ( srcDone_ ) {
+      // stopReading(), this read was let finish
+   }
+   else if ( stats_.queued >= owner_.s_.queue_high )
+      stall();             // sent() carries on below the low water mark
+   else
+      postRecv();
+   finish();
+}
+
+
+//! @brief Completion of a write to the to socket.
+//!
+//! Moves on through the queue, and resumes reading once the queue has
+//! drained to the low water mark.  An error drops whatever is queued and
+//! ends the relay.
+//!
+//! @param res   Bytes written, or -errno.
+void Relay::sent( int res )
+{
+   if ( res == -EINTR || res == -EAGAIN ) {
+      if ( res == -EAGAIN )
+         ++stats_.writes.again;
+      postSend();
+      return;
+   }
+   if ( res < 0 ) {
+      queue_.clear();
+      sent_ = 0;
+      stats_.queued = 0;
+      srcDone_ = true;
+      finish();
+      return;
+   }
+
+   sent_ += res;
+   stats_.queued -= res;
+   stats_.bytes += res;
+   if ( sent_ == (size_t) queue_.front()->len ) {
+      stats_.latency.record( queue_.front()->age() );
+      queue_.pop_front();
+      sent_ = 0;
+   }
+   if ( ! queue_.empty() )
+      postSend();
+
+   if ( paused_ && stats_.queued <= owner_.s_.queue_low ) {
+      unstall();
+      postRecv();
+   }
+   finish();
+}
+
+
+//! Tells the session once the source is done and everything is written.
+void Relay::finish()
+{
+   if ( srcDone_ && queue_.empty() && ! eof_ ) {
+      eof_ = true;
+      done_();
+   }
+}
+
+
+//! @brief Accounts for n more bytes waiting to be written.
+void Relay::queued( size_t n )
+{
+   stats_.queued += n;
+   stats_.peakQueued = std::max( stats_.peakQueued, stats_.queued );
+}
+
+
+//! @brief Pauses reading, if not already paused, and starts the stall clock.
+void Relay::stall()
+{
+   if ( paused_ )
+      return;
+   paused_ = true;
+   ++stats_.stalls;
+   clock_gettime( CLOCK_MONOTONIC, &stallStart_ );
+}
+
+
+//! @brief Resumes reading and adds the time spent paused to the stats.
+void Relay::unstall()
+{
+   if ( ! paused_ )
+      return;
+   paused_ = false;
+   stats_.stallNsec += nsecSince( stallStart_ );
+}
+
+
+//! @brief Stamps a Buffer with this relay's direction and session, and
+//!        hands it to the recorders.
+//! @param b   Buffer holding the bytes just relayed.
+void Relay::record( Buffer& b )
+{
+   b.type = type_;
+   b.session = session_;
+   owner_.alertRecorders( b );
+}
+
+} // end namespace ntee
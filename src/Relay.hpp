@@ -0,0 +1,145 @@
+#ifndef INCLUDED_RELAY_HPP
+#define INCLUDED_RELAY_HPP
+
+#include "Buffer.hpp"
+#include "Uring.hpp"
+#include "Histogram.hpp"
+#include "comm.hpp"
+#include <deque>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <boost/function.hpp>
+
+namespace ntee {
+
+class NTee;
+class Socket;
+
+
+//! @brief Flow control counters of a Relay, or the sum of several.
+struct RelayStats {
+   uint64_t bytes;        //!< bytes written to the to socket
+   size_t queued;         //!< bytes read but not yet written
+   size_t peakQueued;     //!< most bytes ever waiting at once
+   uint64_t stalls;       //!< times reading was paused for the writer
+   uint64_t stallNsec;    //!< total time reading was paused, in nsec
+   uint64_t dropped;      //!< datagrams the to socket had no room for
+   IoCount reads;         //!< read calls on the from socket
+   IoCount writes;        //!< write calls on the to socket
+   Histogram latency;     //!< nsec from read to the last byte written
+
+   RelayStats() : bytes(0), queued(0), peakQueued(0), stalls(0), stallNsec(0),
+                  dropped(0)
+   {  /* empty */ }
+
+   RelayStats& operator+=( const RelayStats& o );
+};
+
+
+//! @brief Where to find the counters of both directions of one session.
+struct SessionStats {
+   unsigned int id;            //!< session number
+   const RelayStats* dir[2];   //!< counters, by TransferType
+};
+
+
+//! @brief One direction of traffic between the L and R sockets.
+//!
+//! Each Session owns two Relays, one moving data from L to R and one
+//! from R to L.  The EventLoop's readiness events for a socket are handed
+//! to the Relay which reads from that socket (read readiness) and to the
+//! Relay which writes to it (write readiness).
+//!
+//! Data read is put on an outbound queue and the queue is only written
+//! out as far as the to socket will take it; the rest waits for write
+//! readiness.  Once the queue holds Settings::queue_high bytes, reading
+//! from the from socket stops until the queue drains to
+//! Settings::queue_low, which pushes back on a fast sender rather than
+//! dropping data or spinning.
+//!
+//! When zero copy is enabled the payload never enters user space on its
+//! way through.  It is splice()d from the from socket into a pipe and from
+//! the pipe on to the to socket.  If anybody is recording, the pipe is
+//! tee()d into a second pipe first and the recorders are fed from that.
+//! The pipe is then the outbound queue, and reading stops whenever it is
+//! not empty.
+//!
+//! With the io_uring engine the Relay is start()ed on a Uring instead of
+//! being driven by readiness events.  It then always has one read of the
+//! from socket in flight, and one write of the head of the queue to the
+//! to socket, resubmitted from their completions.
+class Relay {
+public:
+   Relay( NTee& owner, unsigned int session, TransferType type,
+          Socket& from, Socket& to );
+   ~Relay();
+
+   void onReadable( uint32_t events );
+   void onWritable();
+
+   void start( Uring& ring, const boost::function<void ()>& done );
+   void halt();
+   void stopReading();
+
+   //! @returns true once the from socket has reached end of file, or
+   //!          stopReading() was called, and everything read from it has
+   //!          been passed on.
+   bool eof() const { return eof_; }
+
+   const RelayStats& stats() const { return stats_; }
+
+   const Socket& from() const { return from_; }
+   const Socket& to() const { return to_; }
+
+private:
+   Relay( const Relay& );
+   Relay& operator=( const Relay& );
+
+   void copy( uint32_t events );
+   bool flush();
+   void pump();
+   bool drainPipe();
+   void recordPipe( size_t len );
+   void record( Buffer& b );
+   void queued( size_t n );
+   void stall();
+   void unstall();
+   void postRecv();
+   void postSend();
+   void received( int res );
+   void sent( int res );
+   void finish();
+
+   NTee& owner_;           //!< who to alert with recorded data
+   unsigned int session_;  //!< session id handed to the recorders
+   TransferType type_;     //!< direction of the data
+   Socket& from_;          //!< source of the data
+   Socket& to_;            //!< destination of the data
+   bool eof_;              //!< true when from_ has nothing more to give
+
+   std::deque<BufferPtr> queue_;  //!< chains waiting to be written
+   size_t sent_;           //!< bytes of queue_.front() already written
+   bool hangup_;           //!< from_ reported a hang up not yet acted on
+   bool paused_;           //!< reading stopped for the writer to catch up
+   timespec stallStart_;   //!< when reading was paused
+   RelayStats stats_;      //!< flow control counters
+
+   Uring* ring_;           //!< the io_uring engine, NULL with epoll
+   Uring::Op* recvOp_;     //!< read of from_
+   Uring::Op* sendOp_;     //!< write to to_
+   BufferPtr recvBuf_;     //!< what recvOp_ reads into
+   boost::function<void ()> done_;  //!< told when eof() becomes true
+
+   int pipe_[2];           //!< forwarding pipe, -1 when copying instead
+   int tee_[2];            //!< recording copy of the forwarding pipe
+   size_t pipeSize_;       //!< capacity of each of the pipes
+   size_t pending_;        //!< bytes in pipe_ not yet taken by to_
+   timespec pipeTs_;       //!< when what is in pipe_ was read
+   bool srcDone_;          //!< from_ hit end of file (or an error), or
+                           //!< is not to be read any more
+};
+
+} // end namespace ntee
+
+#endif
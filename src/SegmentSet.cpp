@@ -0,0 +1,152 @@
+#include "SegmentSet.hpp"
+#include "Error.hpp"
+#include "comm.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+
+namespace ntee {
+
+const char SegmentSet::MAGIC[] = "ntee-segments 1";
+
+
+//! @returns the directory part of path, with its trailing slash, or "".
+static std::string dirOf( const std::string& path )
+{
+   std::string::size_type slash = path.rfind( '/' );
+   return ( slash == std::string::npos ) ? "" : path.substr( 0, slash + 1 );
+}
+
+
+//! Makes a set which isn't segmenting.
+SegmentSet::SegmentSet()
+ : fd_(-1), maxBytes_(0), maxSecs_(0), count_(0)
+{
+   start_.tv_sec = start_.tv_nsec = 0;
+}
+
+
+SegmentSet::~SegmentSet()
+{
+   close();
+}
+
+
+//! @brief Starts a segmented recording by creating its manifest.
+//!
+//! @param manifest  path of the manifest.
+//! @param maxBytes  size at which to roll over, 0 for none.
+//! @param maxSecs   age at which to roll over, 0 for none.
+//! @returns 0 when everything is okay, -1 with errno set if the manifest
+//!          couldn't be written.
+int SegmentSet::open( const std::string& manifest, uint64_t maxBytes,
+                      unsigned maxSecs )
+{
+   close();
+   fd_ = ::open( manifest.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666 );
+   if ( fd_ == -1 )
+      return -1;
+   std::string head = std::string(MAGIC) + "\n";
+   if ( write_n( fd_, head.data(), head.size() ) != head.size() ) {
+      close();
+      return -1;
+   }
+   manifest_ = manifest;
+   maxBytes_ = maxBytes;
+   maxSecs_ = maxSecs;
+   count_ = 0;
+   return 0;
+}
+
+
+//! Closes the manifest.
+void SegmentSet::close()
+{
+   if ( fd_ != -1 )
+      ::close( fd_ );
+   fd_ = -1;
+}
+
+
+//! @brief Tells whether to roll over to a new segment before the next
+//!        record.
+//!
+//! @param bytes  bytes written to the current segment.
+//! @param now    CLOCK_MONOTONIC time of the next record.
+//! @returns true if the segment is full or old enough.
+bool SegmentSet::due( uint64_t bytes, const timespec& now ) const
+{
+   if ( fd_ == -1 || count_ == 0 )
+      return false;
+   if ( maxBytes_ && bytes >= maxBytes_ )
+      return true;
+   return maxSecs_ && now.tv_sec - start_.tv_sec >= (time_t) maxSecs_;
+}
+
+
+//! @returns the path of the next segment.
+std::string SegmentSet::path() const
+{
+   char num[16];
+   snprintf( num, sizeof(num), ".%06u", count_ );
+   return manifest_ + num;
+}
+
+
+//! @brief Adds the segment at path() to the manifest, once it has been
+//!        opened.
+//! @param now  CLOCK_MONOTONIC time, which the age of the segment is
+//!             counted from.
+void SegmentSet::opened( const timespec& now )
+{
+   std::string p = path();
+   std::string line = p.substr( dirOf(p).size() ) + "\n";
+   if ( write_n( fd_, line.data(), line.size() ) != line.size() ) {
+      WarnIf( true ).info("Segmenting given up, can't write %s: %s\n",
+                          manifest_.c_str(), strerror(errno));
+      close();
+      return;
+   }
+   ++count_;
+   start_ = now;
+}
+
+
+//! @brief Gives up on segmenting after the segment at path() couldn't be
+//!        opened.  The recording carries on in the current segment.
+void SegmentSet::failed()
+{
+   WarnIf( true ).info("Segmenting given up, can't open %s: %s\n",
+                       path().c_str(), strerror(errno));
+   close();
+}
+
+
+//! @brief Reads a manifest.
+//!
+//! @param manifest  path of the manifest.
+//! @param segments  set to the paths of the segments, in order.
+//! @returns false if manifest isn't one.
+bool SegmentSet::read( const std::string& manifest,
+                       std::vector<std::string>& segments )
+{
+   // Only as much as MAGIC is read to tell, it may be a big data file.
+   std::ifstream in( manifest.c_str() );
+   char head[sizeof(MAGIC)];
+   if ( ! in.read( head, sizeof(head) ) || memcmp( head, MAGIC, sizeof(head)-1 )
+        || head[sizeof(head)-1] != '\n' )
+      return false;
+   std::string line;
+   segments.clear();
+   std::string dir = dirOf( manifest );
+   while( std::getline( in, line ) ) {
+      if ( ! line.empty() )
+         segments.push_back( dir + line );
+   }
+   return true;
+}
+
+} // end namespace ntee
@@ -0,0 +1,62 @@
+#ifndef INCLUDED_SEGMENTSET_HPP
+#define INCLUDED_SEGMENTSET_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+namespace ntee {
+
+//! @brief Names the segments of a recording split across files, and keeps
+//!        its manifest.
+//!
+//! The manifest sits at the path the recording would otherwise have been
+//! written to.  Its first line is MAGIC, followed by the file name of
+//! each segment in order, relative to the manifest's directory.  The
+//! segments are named after the manifest, with a 6 digit number added:
+//! ntee_output.bdr.000000, ntee_output.bdr.000001 and so on.
+//!
+//! A recorder asks due() before each record, and rolls over to path()
+//! when it says so.  Segments are only added to the manifest once they
+//! have been opened().
+class SegmentSet {
+public:
+   //! First line of every manifest.
+   static const char MAGIC[];
+
+   SegmentSet();
+   ~SegmentSet();
+
+   int open( const std::string& manifest, uint64_t maxBytes, unsigned maxSecs );
+   void close();
+
+   //! @returns true if the recording is split into segments.
+   bool enabled() const { return fd_ != -1; }
+
+   bool due( uint64_t bytes, const timespec& now ) const;
+   std::string path() const;
+   void opened( const timespec& now );
+   void failed();
+
+   //! @returns the most bytes a segment is to have, 0 for no limit.
+   uint64_t maxBytes() const { return maxBytes_; }
+
+   static bool read( const std::string& manifest,
+                     std::vector<std::string>& segments );
+
+private:
+   SegmentSet( const SegmentSet& );
+   SegmentSet& operator=( const SegmentSet& );
+
+   std::string manifest_;
+   int fd_;                //!< the manifest, -1 when not segmenting
+   uint64_t maxBytes_;
+   unsigned maxSecs_;
+   unsigned count_;        //!< segments opened so far
+   timespec start_;        //!< when the current segment was opened
+};
+
+} // end namespace ntee
+
+#endif
@@ -0,0 +1,142 @@
+#include "Session.hpp"
+#include "NTee.hpp"
+#include "Socket.hpp"
+#include "EventLoop.hpp"
+#include <fcntl.h>
+#include <boost/bind.hpp>
+
+namespace ntee {
+
+//! @brief Creates a session over an L and R socket pair.
+//!
+//! @param owner  The NTee instance which keeps the session table.
+//! @param id     Session number handed to the recorders.
+//! @param L      Dynamically allocated, connected L side socket.  The
+//!               session takes ownership.
+//! @param R      Dynamically allocated, accepted R side socket.  The
+//!               session takes ownership.
+Session::Session( NTee& owner, unsigned int id, Socket* L, Socket* R )
+ : owner_(owner), id_(id), L_(L), R_(R),
+   LtoR_( owner, id, L_to_R, *L, *R ),
+   RtoL_( owner, id, R_to_L, *R, *L ),
+   loop_(0), closed_(false)
+{
+   // empty
+}
+
+
+//! Closes the sockets if close() has not been called already.
+Session::~Session()
+{
+   close();
+}
+
+
+//! @brief Registers both sockets with an EventLoop.
+//!
+//! Both sockets are forced into non-blocking mode, as required by the
+//! edge-triggered loop.
+//!
+//! @returns 0 on success, -1 with errno set if the loop refused a socket.
+int Session::attach( EventLoop& loop )
+{
+   fcntl(L_->getFD(), F_SETFL, O_NONBLOCK);
+   fcntl(R_->getFD(), F_SETFL, O_NONBLOCK);
+
+   const uint32_t events = EPOLLIN|EPOLLOUT|EPOLLRDHUP;
+   if ( loop.add( L_->getFD(), events,
+                  boost::bind(&Session::dispatch, this, &LtoR_, &RtoL_, _1) ) == -1 )
+      return -1;
+   if ( loop.add( R_->getFD(), events,
+                  boost::bind(&Session::dispatch, this, &RtoL_, &LtoR_, _1) ) == -1 ) {
+      loop.remove( L_->getFD() );
+      return -1;
+   }
+   loop_ = &loop;
+   return 0;
+}
+
+
+//! @brief Runs both Relays on the io_uring engine.
+//!
+//! The sockets are left blocking, io_uring polls for them itself.  The
+//! caller has the ring submit what the Relays queue.
+void Session::start( Uring& ring )
+{
+   LtoR_.start( ring, boost::bind(&Session::relayDone, this) );
+   RtoL_.start( ring, boost::bind(&Session::relayDone, this) );
+}
+
+
+//! @brief Detaches from the loop or ring and closes both sockets.
+void Session::close()
+{
+   LtoR_.halt();
+   RtoL_.halt();
+   if ( loop_ ) {
+      loop_->remove( L_->getFD() );
+      loop_->remove( R_->getFD() );
+      loop_ = 0;
+   }
+   if ( ! closed_ ) {
+      L_->close();
+      R_->close();
+      closed_ = true;
+   }
+}
+
+
+//! @brief Hands a socket's readiness events to its Relays.
+//!
+//! Called back by the EventLoop.  Write readiness goes to the Relay which
+//! writes to the socket, so it can flush what it holds before anything new
+//! is read.  Read readiness goes to the Relay which reads from the socket.
+//! Once done() the session is closed and the owner told about it.
+//!
+//! @param in      The Relay which reads from the ready socket.
+//! @param out     The Relay which writes to the ready socket.
+//! @param events  epoll event mask that fired.
+//!
+void Session::dispatch( Relay* in, Relay* out, uint32_t events )
+{
+   if ( events & EPOLLOUT )
+      out->onWritable();
+   if ( events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR) )
+      in->onReadable( events );
+   if ( done() ) {
+      close();
+      owner_.sessionEnded( id_ );
+   }
+}
+
+
+//! @brief Called by a Relay running on io_uring once it is finished.
+//!
+//! Closes the session and tells the owner once done(), just as
+//! dispatch() does.
+void Session::relayDone()
+{
+   if ( done() ) {
+      close();
+      owner_.sessionEnded( id_ );
+   }
+}
+
+
+//! @brief Tells whether both Relays are finished.
+//!
+//! Once either one is, the other stops reading, but what it has queued
+//! still goes out rather than being lost with the session, as it would
+//! have been written had the writes not been queued.
+//!
+//! @returns true once the session can be closed.
+bool Session::done()
+{
+   if ( LtoR_.eof() == RtoL_.eof() )
+      return LtoR_.eof();
+   LtoR_.stopReading();
+   RtoL_.stopReading();
+   return LtoR_.eof() && RtoL_.eof();
+}
+
+} // end namespace ntee
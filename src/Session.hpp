@@ -0,0 +1,56 @@
+#ifndef INCLUDED_SESSION_HPP
+#define INCLUDED_SESSION_HPP
+
+#include "Relay.hpp"
+#include <boost/scoped_ptr.hpp>
+#include <stdint.h>
+
+namespace ntee {
+
+class NTee;
+class Socket;
+class EventLoop;
+class Uring;
+
+//! @brief One R side connection paired with its own L side connection.
+//!
+//! A Session owns both of its sockets and the two Relays moving data
+//! between them.  NTee keeps every live Session in its session table, and
+//! all of them are served from the one EventLoop, or the one Uring.
+class Session {
+public:
+   Session( NTee& owner, unsigned int id, Socket* L, Socket* R );
+   ~Session();
+
+   int attach( EventLoop& loop );
+   void start( Uring& ring );
+   void close();
+
+   //! @returns the identifier handed to the recorders with each record.
+   unsigned int id() const { return id_; }
+
+   //! @returns the Relay carrying the data in direction dir.
+   const Relay& relay( TransferType dir ) const
+   { return ( dir == L_to_R )?LtoR_:RtoL_; }
+
+private:
+   Session( const Session& );
+   Session& operator=( const Session& );
+
+   void dispatch( Relay* in, Relay* out, uint32_t events );
+   void relayDone();
+   bool done();
+
+   NTee& owner_;                     //!< told when the session ends
+   unsigned int id_;                 //!< session number
+   boost::scoped_ptr<Socket> L_;     //!< connection to the L side
+   boost::scoped_ptr<Socket> R_;     //!< connection from the R side
+   Relay LtoR_;                      //!< L to R direction
+   Relay RtoL_;                      //!< R to L direction
+   EventLoop* loop_;                 //!< loop we are attached to, if any
+   bool closed_;                     //!< true once the sockets are closed
+};
+
+} // end namespace ntee
+
+#endif
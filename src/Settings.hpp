@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 namespace ntee {
 
@@ -13,6 +14,22 @@ const int WILDCARD_PORT = 0;
 //! to a recording file.
 const std::string DEFAULT_OUTPUT("ntee_output");
 
+//! Defines the default number of records each recorder thread can fall
+//! behind the relay before its RecPolicy kicks in.
+const size_t DEFAULT_REC_QUEUE = 4096;
+
+//! Defines the default number of bytes the relay reads from a socket in
+//! one go, the most memory one message can tie up.
+const size_t DEFAULT_READ_BUDGET = 1024*1024;
+
+//! Defines the default number of bytes queued for a slow receiver before
+//! the relay stops reading from the sender.
+const size_t DEFAULT_QUEUE_HIGH = 4*1024*1024;
+
+//! Defines the default number of bytes the queue has to drain down to
+//! before the relay reads from the sender again.
+const size_t DEFAULT_QUEUE_LOW = 1024*1024;
+
 
 //! @brief Structure to hold ntee configuration.
 //!
@@ -25,6 +42,19 @@ struct Settings {
    //! These are the supported protocol options
    enum proto { TCP, UDP };
    
+   //! How the TCP sessions are driven
+   enum Engine {
+      EPOLL,          //!< readiness events, then read()/write()
+      URING           //!< reads and writes submitted to io_uring
+   };
+   
+   //! What to do with a record when its recorder thread has fallen behind
+   enum RecPolicy { 
+      BLOCK,          //!< wait for room, holding up the relay
+      DROP_NEWEST,    //!< throw the new record away
+      DROP_OLDEST     //!< throw the oldest waiting record away
+   };
+   
    proto protocol;                     //!< protocol to use when connecting
    unsigned short srv_port;            //!< port to start on (0 means wildcard!)
    std::string srv_host;               //!< hostname to use when setting up service
@@ -34,6 +64,17 @@ struct Settings {
    char** R_cmd;                       //!< Command line args to start R with
    bool hex_only;
    bool binary_only;
+   bool multi_session;                 //!< keep accepting R clients, one L each
+   bool zero_copy;                     //!< relay with splice()/tee()
+   Engine engine;                      //!< what drives the TCP sessions
+   size_t read_budget;                 //!< most bytes relayed per read
+   size_t queue_high;                  //!< queued bytes which pause reading
+   size_t queue_low;                   //!< queued bytes which resume reading
+   size_t rec_queue;                   //!< records each recorder may lag by
+   RecPolicy rec_policy;               //!< what to do when a recorder lags
+   std::string metrics_path;           //!< Unix socket for metrics, "" for none
+   uint64_t segment_bytes;             //!< recording segment size, 0 for no limit
+   unsigned segment_secs;              //!< recording segment age, 0 for no limit
    
    //! @brief Initializes a default Settings structure.
    //!
@@ -45,8 +86,20 @@ struct Settings {
                 output_filename(DEFAULT_OUTPUT),
                 L_host_ip(""),
                 L_port(""),
+                R_cmd(0),
                 hex_only(false),
-                binary_only(false)
+                binary_only(false),
+                multi_session(false),
+                zero_copy(false),
+                engine(EPOLL),
+                read_budget(DEFAULT_READ_BUDGET),
+                queue_high(DEFAULT_QUEUE_HIGH),
+                queue_low(DEFAULT_QUEUE_LOW),
+                rec_queue(DEFAULT_REC_QUEUE),
+                rec_policy(BLOCK),
+                metrics_path(""),
+                segment_bytes(0),
+                segment_secs(0)
    {  /* empty */ }
 };
 
@@ -19,7 +19,7 @@ public:
    virtual Socket* accept(const char*) = 0;
    
    virtual int send( const ntee::Buffer& ) = 0;
-   virtual Buffer* recv() = 0;
+   virtual BufferPtr recv() = 0;
    
    virtual bool good() const = 0;
    virtual int close() = 0;
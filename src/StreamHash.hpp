@@ -0,0 +1,110 @@
+#ifndef INCLUDED_STREAMHASH_HPP
+#define INCLUDED_STREAMHASH_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include <string.h>
+
+namespace ntee {
+
+//! @brief A 64 bit hash of a byte stream, taken a piece at a time.
+//!
+//! The bytes are mixed in 8 at a time, and the few left over at the end of
+//! a piece are held until the next one makes up a word, so the hash only
+//! depends on the bytes and not on how they were cut up.  That lets what
+//! came off a socket, in whatever sizes TCP chose, be checked against a
+//! record hashed in one go.  It is meant for telling data apart quickly,
+//! not against anyone trying to make two streams collide.
+class StreamHash {
+public:
+   StreamHash() { reset(); }
+
+   //! Starts again on an empty stream.
+   void reset()
+   {
+      h_ = SEED;
+      len_ = 0;
+      tailLen_ = 0;
+   }
+
+   //! Adds the next n bytes of the stream.
+   void update( const char* p, size_t n )
+   {
+      len_ += n;
+      if ( tailLen_ ) {
+         size_t take = ( n < 8 - tailLen_ ) ? n : 8 - tailLen_;
+         memcpy( tail_ + tailLen_, p, take );
+         tailLen_ += take;
+         p += take;
+         n -= take;
+         if ( tailLen_ < 8 )
+            return;
+         h_ = mix( h_, word( tail_ ) );
+         tailLen_ = 0;
+      }
+      for( ; n >= 8; p += 8, n -= 8 )
+         h_ = mix( h_, word( p ) );
+      memcpy( tail_, p, n );
+      tailLen_ = n;
+   }
+
+   //! @returns the hash of the stream so far.
+   uint64_t value() const
+   {
+      uint64_t h = h_;
+      if ( tailLen_ ) {
+         char last[8] = { 0 };
+         memcpy( last, tail_, tailLen_ );
+         h = mix( h, word( last ) );
+      }
+      return finish( h ^ len_ );
+   }
+
+   //! @returns the hash of n bytes at p.
+   static uint64_t of( const char* p, size_t n )
+   {
+      StreamHash h;
+      h.update( p, n );
+      return h.value();
+   }
+
+private:
+   static const uint64_t SEED = 0x9e3779b97f4a7c15ULL;
+   static const uint64_t K1 = 0x87c37b91114253d5ULL;
+   static const uint64_t K2 = 0x4cf5ad432745937fULL;
+
+   static uint64_t word( const char* p )
+   {
+      uint64_t w;
+      memcpy( &w, p, 8 );
+      return w;
+   }
+
+   static uint64_t mix( uint64_t h, uint64_t w )
+   {
+      w *= K1;
+      w = (w << 31) | (w >> 33);
+      h ^= w * K2;
+      return ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+   }
+
+   //! Spreads every bit of h over all of the result, as MurmurHash3 does.
+   static uint64_t finish( uint64_t h )
+   {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+   }
+
+   uint64_t h_;         //!< hash of the whole words so far
+   uint64_t len_;       //!< bytes so far
+   char tail_[8];       //!< bytes past the last whole word
+   size_t tailLen_;
+};
+
+} // end namespace ntee
+
+#endif
@@ -1,7 +1,12 @@
 #include "TCPSocket.hpp"
 #include "Error.hpp"
+#include "BufferPool.hpp"
 #include <iostream>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
 
 namespace ntee {
 
@@ -38,11 +43,16 @@ int TCPSocket::listenOn( Address& addr )
 }
 
 
+//! @returns a dynamically allocated Socket for the new connection, or NULL
+//!          if the listening socket is non-blocking and nobody is waiting.
 Socket* TCPSocket::accept(const char* name) {
    int err = 0;
    sockaddr_in saddr;
    socklen_t len = sizeof(saddr);
-   SysErrIf( (err=::accept(sockfd_, (sockaddr*) &saddr, &len )) == -1 );
+   err = ::accept(sockfd_, (sockaddr*) &saddr, &len );
+   if ( err == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+      return 0;
+   SysErrIf( err == -1 );
    // make an Socket out of client
    return new TCPSocket( name, err );
 }
@@ -50,29 +60,33 @@ Socket* TCPSocket::accept(const char* name) {
 
 //! @brief Send a payload of a Buffer
 //! 
+//! All segments of the Buffer's chain are handed to the kernel in one
+//! call.
+//!
 //! @param buf  Buffer reference to send data from.
 //! @returns the number of bytes sent, -1 with errno set if there was a
 //!          problem.
 int TCPSocket::send( const Buffer& buf )
 {
-   return ::send(sockfd_, buf.buf, buf.len, 0);
+   iovec iov[IOV_MAX];
+   msghdr msg;
+   memset( &msg, 0, sizeof(msg) );
+   msg.msg_iov = iov;
+   msg.msg_iovlen = buf.gather( iov, IOV_MAX );
+   return ::sendmsg(sockfd_, &msg, 0);
 }
 
 
-//! @returns Address of a dynamically allocated Buffer filled with 
-//!          dynamically allocated char* content OR NULL if zero
-//!          bytes were recieved.
-ntee::Buffer* TCPSocket::recv()
+//! @returns a pooled Buffer filled with up to one pool block of received
+//!          content OR NULL if zero bytes were recieved.
+ntee::BufferPtr TCPSocket::recv()
 {
    int err = 0;
-   char* buf = (char*) malloc(10000);
-std::cerr << "recieving data from fd=" << sockfd_ << "\n";
-   SysErrIf( (err=::recv(sockfd_,buf,10000,0)) == -1 );
+   BufferPtr pB = BufferPool::instance().acquire();
+   SysErrIf( (err=::recv(sockfd_,pB->block(),pB->capacity(),0)) == -1 );
    if ( err == 0 ) return 0;
    
-   Buffer* pB = new Buffer();
    pB->len = err;
-   pB->buf = buf;
    return pB;
 }
 
@@ -18,7 +18,7 @@ public:
    Socket* accept(const char* name);
    
    int send( const Buffer& );
-   Buffer* recv();
+   BufferPtr recv();
    
    bool good() const;
    int close();
@@ -0,0 +1,179 @@
+#include "UDPSocket.hpp"
+#include "Error.hpp"
+#include "BufferPool.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace ntee {
+
+//! Most segments of one Buffer chain sent as a single datagram.
+static const int DGRAM_IOV = 8;
+
+
+UDPSocket::UDPSocket(const char* ccp)
+ : Socket(ccp)
+{
+   sockfd_ = socket( AF_INET, SOCK_DGRAM, 0 );
+}
+
+
+//! Sets the peer all datagrams are sent to, and the only one they are
+//! received from.
+int UDPSocket::connectTo( Address& addr )
+{
+   return connect( sockfd_, addr.getAddr(), addr.getLen() );
+}
+
+
+int UDPSocket::listenOn( Address& addr )
+{
+   int err = 0;
+   SysErrIf( (err=bind(sockfd_, addr.getAddr(), addr.getLen() )) == -1 );   
+   
+   // Get values from the kernel for what was assigned during the bind
+   socklen_t len = addr.getLen();
+   SysErrIf( getsockname(sockfd_, addr.getAddr(), &len) == -1 );
+   return err;
+}
+
+
+//! Datagram sockets have no connections to accept.
+//! @returns NULL always.
+Socket* UDPSocket::accept(const char* name)
+{
+   return 0;
+}
+
+
+//! @brief Sends a Buffer as one datagram.
+//! @returns the number of bytes sent, -1 with errno set if there was a
+//!          problem.
+int UDPSocket::send( const Buffer& buf )
+{
+   iovec iov[DGRAM_IOV];
+   msghdr msg;
+   memset( &msg, 0, sizeof(msg) );
+   msg.msg_iov = iov;
+   msg.msg_iovlen = buf.gather( iov, DGRAM_IOV );
+   return ::sendmsg(sockfd_, &msg, 0);
+}
+
+
+//! @returns a pooled Buffer holding the next datagram.  A pool block is
+//!          big enough for any datagram.
+ntee::BufferPtr UDPSocket::recv()
+{
+   int err = 0;
+   BufferPtr pB = BufferPool::instance().acquire();
+   SysErrIf( (err=::recv(sockfd_,pB->block(),pB->capacity(),0)) == -1 );
+   
+   pB->len = err;
+   return pB;
+}
+
+
+//! @brief Receives up to max datagrams with one recvmmsg() call.
+//!
+//! Each datagram is put in a fresh pooled Buffer, time stamped as the call
+//! returns.
+//!
+//! @param bufs     Array of max Buffer pointers, set to the datagrams read.
+//! @param from     Array of max addresses, set to the senders.  May be NULL
+//!                 if the socket is connected.
+//! @param fromlen  Array of max lengths of the from addresses.  May be NULL
+//!                 when from is.
+//! @param max      Most datagrams to read, no more than BATCH.
+//!
+//! @returns the number of datagrams read, 0 if there were none waiting,
+//!          -1 with errno set if there was a problem.
+int UDPSocket::recvBatch( BufferPtr* bufs, sockaddr_storage* from,
+                          socklen_t* fromlen, int max )
+{
+   BufferPool& pool = BufferPool::instance();
+   mmsghdr msgs[BATCH];
+   iovec iov[BATCH];
+   if ( max > BATCH )
+      max = BATCH;
+   
+   memset( msgs, 0, sizeof(mmsghdr) * max );
+   for( int i=0; i < max; ++i ) {
+      bufs[i] = pool.acquire();
+      iov[i].iov_base = bufs[i]->block();
+      iov[i].iov_len = bufs[i]->capacity();
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      if ( from ) {
+         msgs[i].msg_hdr.msg_name = &from[i];
+         msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+      }
+   }
+   
+   int n;
+   while( (n=recvmmsg( sockfd_, msgs, max, MSG_DONTWAIT, 0 )) == -1 
+          && errno == EINTR ) {
+      /* try again */
+   }
+   if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+      n = 0;
+   
+   for( int i=0; i < n; ++i ) {
+      bufs[i]->len = msgs[i].msg_len;
+      bufs[i]->setTime();
+      if ( fromlen )
+         fromlen[i] = msgs[i].msg_hdr.msg_namelen;
+   }
+   // hand back the Buffers nothing was read into.
+   for( int i=( n > 0 )?n:0; i < max; ++i )
+      bufs[i].reset();
+   return n;
+}
+
+
+//! @brief Sends n datagrams with one sendmmsg() call.
+//!
+//! @param bufs   The datagrams, one Buffer (chain) each.
+//! @param n      Number of datagrams, no more than BATCH.
+//! @param to     Where to send them, NULL if the socket is connected.
+//! @param tolen  Length of the to address.
+//!
+//! @returns the number of datagrams sent, which is short of n if the
+//!          socket buffer filled up, or -1 with errno set if not even the
+//!          first could be sent.
+int UDPSocket::sendBatch( const BufferPtr* bufs, int n, 
+                          const sockaddr* to, socklen_t tolen )
+{
+   mmsghdr msgs[BATCH];
+   iovec iov[BATCH][DGRAM_IOV];
+   if ( n > BATCH )
+      n = BATCH;
+   
+   memset( msgs, 0, sizeof(mmsghdr) * n );
+   for( int i=0; i < n; ++i ) {
+      msgs[i].msg_hdr.msg_iov = iov[i];
+      msgs[i].msg_hdr.msg_iovlen = bufs[i]->gather( iov[i], DGRAM_IOV );
+      msgs[i].msg_hdr.msg_name = const_cast<sockaddr*>( to );
+      msgs[i].msg_hdr.msg_namelen = tolen;
+   }
+   
+   int sent;
+   while( (sent=sendmmsg( sockfd_, msgs, n, MSG_DONTWAIT )) == -1 
+          && errno == EINTR ) {
+      /* try again */
+   }
+   return sent;
+}
+
+
+bool UDPSocket::good() const
+{
+   return 1;
+}
+
+
+int UDPSocket::close() {
+   return ::close(sockfd_);
+}
+
+} // end namespace ntee
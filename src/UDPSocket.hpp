@@ -0,0 +1,44 @@
+#ifndef INCLUDED_UDPSOCKET_HPP
+#define INCLUDED_UDPSOCKET_HPP
+
+#include "Socket.hpp"
+#include "Buffer.hpp"
+#include <sys/socket.h>
+
+namespace ntee {
+
+//! @brief A datagram socket.
+//!
+//! Besides the one message at a time Socket interface, datagrams can be
+//! moved in batches with recvBatch() and sendBatch(), which use recvmmsg()
+//! and sendmmsg() so one system call handles many packets.  Every
+//! datagram is kept in a Buffer of its own, so message boundaries are
+//! preserved.
+class UDPSocket : public Socket {
+public:
+   
+   //! Most datagrams moved by one recvBatch() or sendBatch() call.
+   static const int BATCH = 32;
+   
+   UDPSocket(const char*);
+   
+   int connectTo( Address& );
+   int listenOn( Address& );
+   Socket* accept(const char* name);
+   
+   int send( const Buffer& );
+   BufferPtr recv();
+   
+   int recvBatch( BufferPtr* bufs, sockaddr_storage* from, socklen_t* fromlen,
+                  int max );
+   int sendBatch( const BufferPtr* bufs, int n, 
+                  const sockaddr* to = 0, socklen_t tolen = 0 );
+   
+   bool good() const;
+   int close();
+   
+};
+
+}   // end namespace ntee
+
+#endif
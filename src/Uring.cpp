@@ -0,0 +1,400 @@
+#include "Uring.hpp"
+#include "BufferPool.hpp"
+#include "Error.hpp"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#ifndef NTEE_NO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#undef BLOCK_SIZE    // from linux/fs.h, hides BufferPool::BLOCK_SIZE
+#endif
+
+namespace ntee {
+
+#ifndef NTEE_NO_URING
+
+//! The kernel reads what we publish in the rings, and writes what we read.
+template<class T> static T loadAcquire( const T* p )
+{
+   return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+template<class T> static void storeRelease( T* p, T v )
+{
+   __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+
+//! @brief Sets up the ring and registers the first slabs of the BufferPool.
+//!
+//! On any failure the ring is left unusable, good() returns false and
+//! errno tells why.  Failing to register the buffers (typically
+//! RLIMIT_MEMLOCK) is not fatal, the ring then uses plain reads and writes.
+//!
+//! @param entries   Submission ring size, rounded up by the kernel.
+//! @param slabs     Number of BufferPool slabs to reserve and register.
+Uring::Uring( unsigned entries, size_t slabs )
+ : fd_(-1), efd_(-1), sqMem_(MAP_FAILED), cqMem_(MAP_FAILED), sqLen_(0),
+   cqLen_(0), sqes_((io_uring_sqe*) MAP_FAILED), sqesLen_(0), tail_(0),
+   reaping_(false)
+{
+   io_uring_params p;
+   memset( &p, 0, sizeof(p) );
+   if ( (fd_=syscall( __NR_io_uring_setup, entries, &p )) == -1 )
+      return;
+
+   sqLen_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   cqLen_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+   if ( p.features & IORING_FEAT_SINGLE_MMAP )
+      sqLen_ = cqLen_ = std::max( sqLen_, cqLen_ );
+   sqesLen_ = p.sq_entries * sizeof(io_uring_sqe);
+
+   sqMem_ = mmap( 0, sqLen_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                  fd_, IORING_OFF_SQ_RING );
+   if ( p.features & IORING_FEAT_SINGLE_MMAP )
+      cqMem_ = sqMem_;
+   else
+      cqMem_ = mmap( 0, cqLen_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                     fd_, IORING_OFF_CQ_RING );
+   sqes_ = (io_uring_sqe*) mmap( 0, sqesLen_, PROT_READ|PROT_WRITE, 
+                                 MAP_SHARED|MAP_POPULATE, fd_, IORING_OFF_SQES );
+   if ( sqMem_ == MAP_FAILED || cqMem_ == MAP_FAILED || sqes_ == MAP_FAILED ) {
+      int err = errno;
+      unmap();
+      errno = err;
+      return;
+   }
+
+   char* sq = (char*) sqMem_;
+   sqHead_ = (unsigned*) (sq + p.sq_off.head);
+   sqTail_ = (unsigned*) (sq + p.sq_off.tail);
+   sqFlags_ = (unsigned*) (sq + p.sq_off.flags);
+   sqArray_ = (unsigned*) (sq + p.sq_off.array);
+   sqMask_ = *(unsigned*) (sq + p.sq_off.ring_mask);
+   sqEntries_ = p.sq_entries;
+   tail_ = *sqTail_;
+
+   char* cq = (char*) cqMem_;
+   cqHead_ = (unsigned*) (cq + p.cq_off.head);
+   cqTail_ = (unsigned*) (cq + p.cq_off.tail);
+   cqMask_ = *(unsigned*) (cq + p.cq_off.ring_mask);
+   cqes_ = (io_uring_cqe*) (cq + p.cq_off.cqes);
+
+   if ( (efd_=::eventfd( 0, EFD_NONBLOCK|EFD_CLOEXEC )) == -1 
+        || syscall( __NR_io_uring_register, fd_, IORING_REGISTER_EVENTFD, 
+                    &efd_, 1 ) == -1 ) {
+      int err = errno;
+      unmap();
+      errno = err;
+      return;
+   }
+
+   BufferPool& pool = BufferPool::instance();
+   pool.reserve( slabs );
+   std::vector<iovec> iov( slabs );
+   for( size_t i=0; i < slabs; ++i ) {
+      iov[i].iov_base = pool.slab(i);
+      iov[i].iov_len = BufferPool::SLAB_BUFFERS * BufferPool::BLOCK_SIZE;
+   }
+   int rc = syscall( __NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS,
+                     &iov[0], slabs );
+   WarnIf( slabs > 0 && rc == -1 ).info("Unable to register io_uring buffers "
+                                        "(%s), not using fixed buffers\n",
+                                        strerror(errno));
+   if ( rc != -1 ) {
+      for( size_t i=0; i < slabs; ++i )
+         fixed_.push_back( (char*) iov[i].iov_base );
+   }
+}
+
+
+//! @brief Cancels whatever is still in flight and tears the ring down.
+//!
+//! The Buffers of busy operations are only let go of once the kernel has
+//! confirmed it is done with them.
+Uring::~Uring()
+{
+   if ( fd_ != -1 ) {
+      size_t busy = 0;
+      std::set<Op*>::iterator iter = ops_.begin();
+      for( ; iter != ops_.end(); ++iter ) {
+         if ( (*iter)->busy ) {
+            cancel( *iter );
+            ++busy;
+         }
+      }
+      submit();
+      while( busy > 0 ) {
+         if ( enter( 0, 1, IORING_ENTER_GETEVENTS ) == -1 && errno != EINTR )
+            break;
+         unsigned head = *cqHead_;
+         unsigned tail = loadAcquire( cqTail_ );
+         for( ; head != tail; ++head ) {
+            Op* op = (Op*) cqes_[head & cqMask_].user_data;
+            if ( op && op->busy ) {
+               op->busy = false;
+               --busy;
+            }
+         }
+         storeRelease( cqHead_, head );
+      }
+   }
+
+   std::set<Op*>::iterator iter = ops_.begin();
+   for( ; iter != ops_.end(); ++iter )
+      delete *iter;
+   unmap();
+}
+
+
+//! Unmaps the rings and closes the descriptors, leaving good() false.
+void Uring::unmap()
+{
+   if ( sqes_ != MAP_FAILED )
+      munmap( sqes_, sqesLen_ );
+   if ( cqMem_ != MAP_FAILED && cqMem_ != sqMem_ )
+      munmap( cqMem_, cqLen_ );
+   if ( sqMem_ != MAP_FAILED )
+      munmap( sqMem_, sqLen_ );
+   sqes_ = (io_uring_sqe*) MAP_FAILED;
+   cqMem_ = sqMem_ = MAP_FAILED;
+   if ( efd_ != -1 )
+      ::close( efd_ );
+   if ( fd_ != -1 )
+      ::close( fd_ );
+   efd_ = fd_ = -1;
+}
+
+
+//! @returns a cleared submission entry queued for the next submit(), or
+//!          NULL if the ring is full even after submitting what's queued.
+io_uring_sqe* Uring::sqe()
+{
+   if ( tail_ - loadAcquire( sqHead_ ) >= sqEntries_ ) {
+      submit();
+      if ( tail_ - loadAcquire( sqHead_ ) >= sqEntries_ )
+         return 0;
+   }
+   unsigned idx = tail_ & sqMask_;
+   io_uring_sqe* e = &sqes_[idx];
+   memset( e, 0, sizeof(*e) );
+   sqArray_[idx] = idx;
+   ++tail_;
+   return e;
+}
+
+
+//! @returns the index of the registered slab holding p, -1 if none does.
+int Uring::slabOf( const char* p ) const
+{
+   const size_t len = BufferPool::SLAB_BUFFERS * BufferPool::BLOCK_SIZE;
+   for( size_t i=0; i < fixed_.size(); ++i ) {
+      if ( p >= fixed_[i] && p < fixed_[i] + len )
+         return i;
+   }
+   return -1;
+}
+
+
+//! Calls io_uring_enter().
+int Uring::enter( unsigned submit, unsigned wait, unsigned flags )
+{
+   return syscall( __NR_io_uring_enter, fd_, submit, wait, flags, 0, 0 );
+}
+
+
+//! @brief Queues a read filling a pooled Buffer's block.
+//!
+//! @param op   The operation to carry it, which must not be busy.
+//! @param fd   Descriptor to read from.
+//! @param b    Buffer to read into, held on to until the read completes.
+//!
+//! @returns false if the ring had no room for it.
+bool Uring::read( Op* op, int fd, const BufferPtr& b )
+{
+   io_uring_sqe* e = sqe();
+   if ( e == 0 )
+      return false;
+   int idx = slabOf( b->block() );
+   e->opcode = ( idx >= 0 )?IORING_OP_READ_FIXED:IORING_OP_READ;
+   e->fd = fd;
+   e->addr = (uintptr_t) b->block();
+   e->len = b->capacity();
+   e->buf_index = ( idx >= 0 )?idx:0;
+   e->user_data = (uintptr_t) op;
+   op->buf = b;
+   op->busy = true;
+   return true;
+}
+
+
+//! @brief Queues a write of one Buffer segment.
+//!
+//! @param op   The operation to carry it, which must not be busy.
+//! @param fd   Descriptor to write to.
+//! @param b    Buffer to write from, held on to until the write completes.
+//! @param off  Bytes at the front of the Buffer already written.
+//!
+//! @returns false if the ring had no room for it.
+bool Uring::write( Op* op, int fd, const BufferPtr& b, size_t off )
+{
+   io_uring_sqe* e = sqe();
+   if ( e == 0 )
+      return false;
+   int idx = slabOf( b->buf );
+   e->opcode = ( idx >= 0 )?IORING_OP_WRITE_FIXED:IORING_OP_WRITE;
+   e->fd = fd;
+   e->addr = (uintptr_t) (b->buf + off);
+   e->len = b->len - off;
+   e->buf_index = ( idx >= 0 )?idx:0;
+   e->user_data = (uintptr_t) op;
+   op->buf = b;
+   op->busy = true;
+   return true;
+}
+
+
+//! @brief Asks the kernel to cancel the operation, if it is busy.  It
+//!        still completes, with -ECANCELED if the cancel got there first.
+void Uring::cancel( Op* op )
+{
+   if ( ! op->busy )
+      return;
+   io_uring_sqe* e = sqe();
+   if ( e == 0 )
+      return;
+   e->opcode = IORING_OP_ASYNC_CANCEL;
+   e->fd = -1;
+   e->addr = (uintptr_t) op;
+}
+
+
+//! @brief Hands everything queued to the kernel in one system call.
+//! @returns the number of entries submitted, -1 with errno set on failure.
+int Uring::submit()
+{
+   unsigned n = tail_ - *sqTail_;
+   if ( n == 0 )
+      return 0;
+   storeRelease( sqTail_, tail_ );
+   int rc;
+   while( (rc=enter( n, 0, 0 )) == -1 && errno == EINTR ) {
+      /* try again */
+   }
+   return rc;
+}
+
+
+//! @brief Calls back the owners of all completed operations.
+//!
+//! Meant to be the EventLoop handler of eventfd().  The eventfd is reset
+//! before the completion ring is looked at, so nothing completing
+//! meanwhile goes unnoticed.  Whatever the handlers queue is submitted
+//! in one go at the end.
+void Uring::reap()
+{
+   uint64_t count;
+   while( ::read( efd_, &count, sizeof(count) ) == -1 && errno == EINTR ) {
+      /* try again */
+   }
+
+   reaping_ = true;
+   for( ;; ) {
+      unsigned head = *cqHead_;
+      unsigned tail = loadAcquire( cqTail_ );
+      if ( head == tail ) {
+         // completions the ring had no room for wait in the kernel.
+         if ( loadAcquire( sqFlags_ ) & IORING_SQ_CQ_OVERFLOW ) {
+            enter( 0, 0, IORING_ENTER_GETEVENTS );
+            continue;
+         }
+         break;
+      }
+
+      for( ; head != tail; ++head ) {
+         const io_uring_cqe& c = cqes_[head & cqMask_];
+         Op* op = (Op*) c.user_data;
+         int res = c.res;
+         storeRelease( cqHead_, head+1 );
+         if ( op == 0 )
+            continue;      // a cancel request
+
+         op->busy = false;
+         op->buf.reset();
+         if ( op->released ) {
+            ops_.erase( op );
+            graveyard_.push_back( op );
+         }
+         else
+            op->handler( res );
+      }
+   }
+   reaping_ = false;
+
+   for( size_t i=0; i < graveyard_.size(); ++i )
+      delete graveyard_[i];
+   graveyard_.clear();
+   submit();
+}
+
+#else // NTEE_NO_URING
+
+//! Built without io_uring: good() is always false.
+Uring::Uring( unsigned entries, size_t slabs )
+ : fd_(-1), efd_(-1), reaping_(false)
+{
+   errno = ENOSYS;
+}
+
+Uring::~Uring()
+{
+   std::set<Op*>::iterator iter = ops_.begin();
+   for( ; iter != ops_.end(); ++iter )
+      delete *iter;
+}
+
+bool Uring::read( Op* op, int fd, const BufferPtr& b ) { return false; }
+bool Uring::write( Op* op, int fd, const BufferPtr& b, size_t off ) { return false; }
+void Uring::cancel( Op* op ) { }
+int Uring::submit() { return 0; }
+void Uring::reap() { }
+
+#endif // NTEE_NO_URING
+
+
+//! @returns a new, idle operation calling h back on completion.
+Uring::Op* Uring::newOp( const Handler_t& h )
+{
+   Op* op = new Op;
+   op->handler = h;
+   op->busy = false;
+   op->released = false;
+   ops_.insert( op );
+   return op;
+}
+
+
+//! @brief Gives an operation back.
+//!
+//! A busy operation is cancelled and freed once it completes; its handler
+//! is not called again either way.  Safe to call from within a handler.
+void Uring::release( Op* op )
+{
+   op->released = true;
+   if ( op->busy ) {
+      cancel( op );
+      return;
+   }
+   ops_.erase( op );
+   if ( reaping_ )
+      graveyard_.push_back( op );
+   else
+      delete op;
+}
+
+} // end namespace ntee
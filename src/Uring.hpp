@@ -0,0 +1,102 @@
+#ifndef INCLUDED_URING_HPP
+#define INCLUDED_URING_HPP
+
+#include "Buffer.hpp"
+#include <set>
+#include <vector>
+#include <stdint.h>
+#include <boost/function.hpp>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace ntee {
+
+//! @brief A minimal io_uring submission/completion ring.
+//!
+//! Talks to the kernel through the raw system calls, no liburing needed.
+//! Operations are queued as submission entries and go to the kernel in
+//! one io_uring_enter() per submit(), however many there are.  The first
+//! slabs of the BufferPool are registered with the kernel, reads and
+//! writes on Buffers from them use the fixed buffer opcodes.
+//!
+//! Completions are announced on an eventfd, which is registered with the
+//! EventLoop like any other descriptor; its handler calls reap().  Built
+//! with NTEE_NO_URING, or on a kernel without io_uring, good() is false
+//! and the caller is expected to stay on the epoll path.
+class Uring {
+public:
+   //! Completion callback type.  The argument is the operation's result,
+   //! as for the equivalent system call but with -errno on failure.
+   typedef boost::function<void (int)> Handler_t;
+
+   //! @brief One outstanding operation at a time of some client.
+   //!
+   //! Its address is the user data of the submission entry.  The client
+   //! keeps reusing it and hands it back with release() when done.
+   struct Op {
+      Handler_t handler;   //!< called with the result of each operation
+      BufferPtr buf;       //!< keeps the memory in use by the kernel alive
+      bool busy;           //!< submitted and not yet completed
+      bool released;       //!< client let go, freed once no longer busy
+   };
+
+   Uring( unsigned entries, size_t slabs );
+   ~Uring();
+
+   //! @returns true if the ring was set up.
+   bool good() const { return fd_ != -1; }
+
+   //! @returns the descriptor which becomes readable on completions.
+   int eventfd() const { return efd_; }
+
+   //! @returns the number of BufferPool slabs registered with the kernel.
+   size_t fixed() const { return fixed_.size(); }
+
+   Op* newOp( const Handler_t& h );
+   void release( Op* op );
+
+   bool read( Op* op, int fd, const BufferPtr& b );
+   bool write( Op* op, int fd, const BufferPtr& b, size_t off );
+   void cancel( Op* op );
+
+   int submit();
+   void reap();
+
+private:
+   Uring( const Uring& );
+   Uring& operator=( const Uring& );
+
+   io_uring_sqe* sqe();
+   int slabOf( const char* p ) const;
+   int enter( unsigned submit, unsigned wait, unsigned flags );
+   void unmap();
+
+   int fd_;                       //!< the ring, -1 if not set up
+   int efd_;                      //!< completion eventfd
+   void* sqMem_;                  //!< submission ring mapping
+   void* cqMem_;                  //!< completion ring mapping
+   size_t sqLen_;                 //!< length of sqMem_
+   size_t cqLen_;                 //!< length of cqMem_
+   io_uring_sqe* sqes_;           //!< submission entries
+   size_t sqesLen_;               //!< length of the sqes_ mapping
+   unsigned* sqHead_;             //!< kernel's submission head
+   unsigned* sqTail_;             //!< our submission tail, as published
+   unsigned* sqFlags_;            //!< submission ring flags
+   unsigned* sqArray_;            //!< submission index array
+   unsigned sqMask_;              //!< submission ring size - 1
+   unsigned sqEntries_;           //!< submission ring size
+   unsigned tail_;                //!< our submission tail, not yet published
+   unsigned* cqHead_;             //!< our completion head
+   unsigned* cqTail_;             //!< kernel's completion tail
+   unsigned cqMask_;              //!< completion ring size - 1
+   io_uring_cqe* cqes_;           //!< completion entries
+   std::vector<char*> fixed_;     //!< start of each registered slab
+   std::set<Op*> ops_;            //!< every Op not yet freed
+   std::vector<Op*> graveyard_;   //!< released during reap(), freed after
+   bool reaping_;                 //!< inside reap()
+};
+
+} // end namespace ntee
+
+#endif
@@ -0,0 +1,298 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include "Error.hpp"
+#include "Settings.hpp"
+#include "Buffer.hpp"
+#include "BufferPool.hpp"
+#include "FileRecorder.hpp"
+#include "BinaryDataRecorder.hpp"
+#include "BinaryDataReader.hpp"
+#include "comm.hpp"
+using namespace ntee;
+
+// glibc's own allocator, which the counting versions below hand on to.
+extern "C" void* __libc_malloc( size_t );
+extern "C" void* __libc_calloc( size_t, size_t );
+extern "C" void* __libc_realloc( void*, size_t );
+
+//! Calls to the allocator since start up.  operator new comes through
+//! malloc() too, so everything is counted once.
+static boost::atomic<uint64_t> allocs(0);
+
+extern "C" void* malloc( size_t n )
+{
+   allocs.fetch_add( 1, boost::memory_order_relaxed );
+   return __libc_malloc( n );
+}
+
+extern "C" void* calloc( size_t n, size_t sz )
+{
+   allocs.fetch_add( 1, boost::memory_order_relaxed );
+   return __libc_calloc( n, sz );
+}
+
+extern "C" void* realloc( void* p, size_t n )
+{
+   allocs.fetch_add( 1, boost::memory_order_relaxed );
+   return __libc_realloc( p, n );
+}
+
+
+//! Message sizes every benchmark is run at, 16 B to 1 MB.
+static const size_t SIZES[] = { 16, 64, 256, 1024, 4096, 16384, 65536,
+                                262144, 1048576 };
+
+//! Least time each measurement runs for, in nsec.
+static const uint64_t MIN_NSEC = 200000000ULL;
+
+//! Scratch directory for the files the benchmarks write.
+static std::string scratch;
+
+//! Where a benchmark leaves what it worked out, so that it isn't left out.
+static volatile uint64_t checksum;
+
+
+//! @returns CLOCK_MONOTONIC in nsec.
+static uint64_t nowNsec()
+{
+   timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//! @brief A benchmark at one message size.
+//!
+//! setup() is called with the number of operations to do before each
+//! timed run, and op() once per operation.  Neither is counted.
+struct Bench {
+   virtual ~Bench() {}
+   virtual void setup( size_t ops ) {}
+   virtual void op() = 0;
+   virtual void teardown() {}
+};
+
+
+//! @brief Times a benchmark and prints a line of results.
+//!
+//! The number of operations is doubled until a run lasts MIN_NSEC, so
+//! each size gets about the same time however slow it is.
+//!
+//! @param name   Benchmark name.
+//! @param size   Message size.
+//! @param b      The benchmark.
+static void measure( const char* name, size_t size, Bench& b )
+{
+   size_t ops = 1;
+   uint64_t nsec, count;
+   for( ;; ) {
+      b.setup( ops );
+      uint64_t a0 = allocs.load();
+      uint64_t t0 = nowNsec();
+      for( size_t i=0; i < ops; ++i )
+         b.op();
+      nsec = nowNsec() - t0;
+      count = allocs.load() - a0;
+      b.teardown();
+      if ( nsec >= MIN_NSEC )
+         break;
+      ops *= 2;
+   }
+   double perOp = (double) nsec / ops;
+   printf( "%-20s %8lu B %12.1f ns/op %10.2f MB/s %8.2f allocs/op\n",
+           name, (unsigned long) size, perOp, size * 1e3 / perOp,
+           (double) count / ops );
+   fflush( stdout );
+}
+
+
+//! write_n() of a message on one end of a socketpair and read_n() of it
+//! on the other.  A thread writes so that messages bigger than the socket
+//! buffer don't deadlock; the time is that of the reader.
+struct CommBench : Bench {
+   size_t size;
+   int fds[2];
+   std::vector<char> out, in;
+   boost::thread* writer;
+
+   explicit CommBench( size_t n ) : size(n), out(n, 'X'), in(n), writer(0) {}
+
+   void write( size_t ops ) {
+      for( size_t i=0; i < ops; ++i )
+         write_n( fds[1], &out[0], size );
+   }
+   virtual void setup( size_t ops ) {
+      SysErrIf( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == -1 );
+      writer = new boost::thread( boost::bind(&CommBench::write, this, ops) );
+   }
+   virtual void op() {
+      read_n( fds[0], &in[0], size );
+   }
+   virtual void teardown() {
+      writer->join();
+      delete writer;
+      close( fds[0] );
+      close( fds[1] );
+   }
+};
+
+
+//! FileRecorder::record(), the header and hex dump of one message, to
+//! /dev/null so that only the formatting is timed.
+struct HexBench : Bench {
+   Settings s;
+   FileRecorder* rec;
+   BufferPtr msg;
+
+   explicit HexBench( size_t n ) {
+      s.output_filename = "/dev/null";
+      rec = new FileRecorder( s );
+      msg = BufferPool::instance().acquire( n );
+      for( size_t i=0; i < n; ++i )
+         msg->block()[i] = (char) i;
+      msg->type = L_to_R;
+      msg->len = n;
+   }
+   ~HexBench() { rec->shutdown(); delete rec; }
+   virtual void op() { rec->record( *msg ); }
+};
+
+
+//! BinaryDataRecorder::record() of one message to /dev/null.
+struct BinaryBench : Bench {
+   BinaryDataRecorder rec;
+   BufferPtr msg;
+
+   explicit BinaryBench( size_t n ) {
+      SysErrIf( rec.open( "/dev/null" ) == -1 );
+      msg = BufferPool::instance().acquire( n );
+      memset( msg->block(), 'X', n );
+      msg->type = L_to_R;
+      msg->len = n;
+   }
+   ~BinaryBench() { rec.shutdown(); }
+   virtual void op() { rec.record( *msg ); }
+};
+
+
+//! BinaryDataReader::next() of one message from a file of them written by
+//! the BinaryDataRecorder beforehand, and a sum of its payload, since a
+//! view on its own reads no more than the header.  The file is kept to
+//! MAX_FILE, well inside the page cache, and read over again from the
+//! start as needed.
+struct ReaderBench : Bench {
+   static const size_t MAX_FILE = 64*1024*1024;
+   size_t size;
+   std::string path;
+   BinaryDataReader* reader;
+   uint64_t sum;
+
+   explicit ReaderBench( size_t n ) : size(n), reader(0), sum(0) {
+      path = scratch + "/reader.bdr";
+   }
+   virtual void setup( size_t ops ) {
+      BinaryDataRecorder rec;
+      SysErrIf( rec.open( path ) == -1 );
+      BufferPtr msg = BufferPool::instance().acquire( size );
+      memset( msg->block(), 'X', size );
+      msg->len = size;
+      ops = std::min( ops, MAX_FILE / size );
+      for( size_t i=0; i < ops; ++i ) {
+         msg->type = ( i % 2 ) ? R_to_L : L_to_R;
+         rec.record( *msg );
+      }
+      rec.shutdown();
+      reader = new BinaryDataReader;
+      SysErrIf( reader->open( path ) == -1 );
+   }
+   virtual void op() {
+      RecordView v;
+      if ( reader->eof() )
+         SysErrIf( reader->open( path ) == -1 );
+      ErrIf( ! reader->next( v ) || v.len != size )
+         .info("Record of %lu bytes read back short\n", (unsigned long) size);
+      uint64_t w;
+      for( size_t i=0; i + sizeof(w) <= v.len; i += sizeof(w) ) {
+         memcpy( &w, v.data + i, sizeof(w) );
+         sum += w;
+      }
+   }
+   virtual void teardown() {
+      checksum = sum;
+      delete reader;
+      unlink( path.c_str() );
+      unlink( (path + ".idx").c_str() );
+   }
+};
+
+const size_t ReaderBench::MAX_FILE;
+
+
+//! @brief Runs a benchmark at every message size.
+//! @param name   Benchmark name.
+//! @param make   Makes the benchmark for a message size.
+static void sweep( const char* name,
+                   const boost::function<Bench* (size_t)>& make )
+{
+   for( size_t i=0; i < sizeof(SIZES)/sizeof(SIZES[0]); ++i ) {
+      Bench* b = make( SIZES[i] );
+      measure( name, SIZES[i], *b );
+      delete b;
+   }
+}
+
+
+template <typename B>
+static Bench* make( size_t n ) { return new B( n ); }
+
+
+//! @brief Microbenchmarks of the hot paths of ntee and the player.
+//!
+//! Every benchmark is run at message sizes from 16 B to 1 MB, and reports
+//! the time, throughput and allocator calls per message.  Naming one or
+//! more benchmarks runs just those.
+int main( int argc, char** argv )
+{
+   std::string USAGE("Usage: ntee_bench [comm] [hex] [binary] [reader]\n");
+   const char* names[] = { "comm", "hex", "binary", "reader" };
+   boost::function<Bench* (size_t)> makers[] = { make<CommBench>,
+      make<HexBench>, make<BinaryBench>, make<ReaderBench> };
+   const size_t count = sizeof(names)/sizeof(names[0]);
+
+   std::vector<bool> run( count, argc == 1 );
+   for( int i=1; i < argc; ++i ) {
+      size_t j = 0;
+      while( j < count && strcmp( argv[i], names[j] ) )
+         ++j;
+      ErrIf( j == count ).info(USAGE);
+      run[j] = true;
+   }
+
+   char dir[] = "/tmp/ntee_bench.XXXXXX";
+   SysErrIf( mkdtemp( dir ) == 0 );
+   scratch = dir;
+
+   // Fill the BufferPool first so that its growth isn't counted.  Each
+   // benchmark holds one message at a time, well within a slab.
+   BufferPool::instance().reserve( 2 );
+
+   for( size_t j=0; j < count; ++j ) {
+      if ( run[j] )
+         sweep( names[j], makers[j] );
+   }
+   rmdir( dir );
+   return 0;
+}
@@ -1,8 +1,14 @@
 #include "comm.hpp"
+#include "BufferPool.hpp"
 #include <errno.h>
 #include <unistd.h>
 #include <iostream>
 #include <stdlib.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+//! Most segments handed to a single readv() or writev() call.
+static const int IOV_BATCH = 16;
 
 
 //! @brief  Write a full buffer.
@@ -16,28 +22,31 @@
 //! @param len  length in bytes of the buffer.
 //!
 //! @returns the number of bytes actually sent to the file descriptor,
-//!          in the case of an error -1 will be returned.
+//!          which is short of len if a non-blocking descriptor would
+//!          block.  In the case of an error -1 will be returned.
 //!
 //! @note { <i>Credit:</i>  Unix Network Programming Vol 1. Richard Stevens (pp. 79) }
 //!
 size_t write_n( int fd, const void* buf, size_t len )
 {
    ssize_t sent = 0;
+   size_t sofar = 0;
    const char* ptr = reinterpret_cast<const char*>(buf);
    
-   std::cout << "Writing: " << len << " (" << ptr << ")\n";
-   
    while( len > 0 ) {
       if ( (sent=write(fd, ptr, len)) <= 0 ) {
-         if ( errno == EINTR )
+         if ( sent < 0 && errno == EINTR )
             sent = 0;
+         else if ( sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+            break;    // return what was sent so far.
          else
             return -1;
       }
       len -= sent;
       ptr += sent;
+      sofar += sent;
    }
-   return len;
+   return sofar;
 }
 
 
@@ -157,7 +166,8 @@ size_t read_n( int fd, std::string& s )
 //!                will default to 1024 bytes.
 //!
 //! @returns integer length of allocated buffer and the pointer at buf will
-//!           be assigned with the address of the allocated buffer.
+//!           be assigned with the address of the allocated buffer. -1 is
+//!           returned if the very first read failed.
 //!
 size_t read_n( int fd, char** buf, size_t allocsz )
 {
@@ -174,6 +184,150 @@ size_t read_n( int fd, char** buf, size_t allocsz )
          throw std::bad_alloc();
    }
    
+   // An error after some data was read still hands back that data.
+   if ( got == (size_t) -1 )
+      return ( total > 0 )?total:-1;
    return total+got;
 }
-         
+
+
+//! @brief Reads into a chain of pooled segments.
+//!
+//! Fresh segments are taken from the BufferPool and filled with readv(),
+//! a batch at a time, until the descriptor would block, reaches end of
+//! file, or budget bytes have been read.  Memory used is therefore bounded
+//! by the budget no matter how much is waiting on the descriptor; when the
+//! budget runs out the caller should come back for more.  Segments left
+//! unused go straight back to the pool.
+//!
+//! @param fd      File descriptor to read from
+//! @param head    Set to the first segment of the chain read, or NULL if
+//!                nothing was read.  Its time stamp is taken as the read
+//!                returns.
+//! @param budget  Most bytes to read.
+//! @param io      If given, the readv() calls made are added to it.
+//!
+//! @returns the number of bytes read, which is less than budget only if
+//!          the descriptor was drained.  -1 is returned if the very first
+//!          read failed.
+//!
+size_t read_chain( int fd, ntee::BufferPtr& head, size_t budget,
+                   IoCount* io )
+{
+   using ntee::BufferPtr;
+   ntee::BufferPool& pool = ntee::BufferPool::instance();
+   
+   head.reset();
+   ntee::Buffer* tail = 0;
+   size_t total = 0;
+   
+   while( total < budget ) {
+      BufferPtr segs[IOV_BATCH];
+      iovec iov[IOV_BATCH];
+      size_t want = 0;
+      int n = 0;
+      for( ; n < IOV_BATCH && total+want < budget; ++n ) {
+         segs[n] = pool.acquire();
+         iov[n].iov_base = segs[n]->block();
+         iov[n].iov_len = std::min( segs[n]->capacity(), budget-total-want );
+         want += iov[n].iov_len;
+      }
+      
+      ssize_t got = readv( fd, iov, n );
+      if ( io )
+         ++io->calls;
+      if ( got < 0 ) {
+         if ( errno == EINTR )
+            continue;
+         if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+            if ( io )
+               ++io->again;
+            break;
+         }
+         return ( total > 0 )?total:-1;
+      }
+      if ( got == 0 )
+         break;   // EOF
+      
+      // link the filled segments onto the chain.
+      size_t left = got;
+      for( int i=0; i < n && left > 0; ++i ) {
+         segs[i]->len = std::min( left, iov[i].iov_len );
+         left -= segs[i]->len;
+         if ( tail )
+            tail->next = segs[i];
+         else
+            head = segs[i];
+         tail = segs[i].get();
+      }
+      total += got;
+      
+      if ( (size_t) got < want )
+         break;   // short read, drained
+   }
+   
+   if ( head )
+      head->setTime();
+   return total;
+}
+
+
+//! @brief Writes a full segment chain.
+//!
+//! Writes every segment of the chain with writev(), picking up where it
+//! left off after a partial write or an interruption.
+//!
+//! @param fd    File descriptor to write to
+//! @param head  First segment of the chain.
+//! @param skip  Bytes at the front of the chain written by an earlier call.
+//! @param io    If given, the writev() calls made are added to it.
+//!
+//! @returns the number of bytes actually written by this call.  This is
+//!          less than the size of the chain, less skip, if the descriptor
+//!          would block, and -1 if there was any other error.
+//!
+size_t write_chain( int fd, const ntee::Buffer& head, size_t skip,
+                    IoCount* io )
+{
+   size_t total = 0;
+   const ntee::Buffer* seg = &head;
+   
+   // skip becomes the bytes of seg already written.
+   while( seg && skip >= (size_t) seg->len ) {
+      skip -= seg->len;
+      seg = seg->next.get();
+   }
+   
+   while( seg ) {
+      iovec iov[IOV_BATCH];
+      int n = seg->gather( iov, IOV_BATCH );
+      if ( n == 0 )
+         break;
+      iov[0].iov_base = (char*) iov[0].iov_base + skip;
+      iov[0].iov_len -= skip;
+      
+      ssize_t sent = writev( fd, iov, n );
+      if ( io )
+         ++io->calls;
+      if ( sent < 0 ) {
+         if ( errno == EINTR )
+            continue;
+         if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+            if ( io )
+               ++io->again;
+            return total;
+         }
+         return -1;
+      }
+      total += sent;
+      
+      // step over what was written.
+      size_t left = sent + skip;
+      while( seg && left >= (size_t) seg->len ) {
+         left -= seg->len;
+         seg = seg->next.get();
+      }
+      skip = left;
+   }
+   return total;
+}
@@ -1,9 +1,19 @@
 #ifndef INCLUDED_COMM_HPP
 #define INCLUDED_COMM_HPP
 
+#include "Buffer.hpp"
 #include <string>
+#include <stdint.h>
 #include <sys/types.h>
 
+//! Tally of the system calls made by read_chain() or write_chain().
+struct IoCount {
+   uint64_t calls;   //!< readv() or writev() calls made
+   uint64_t again;   //!< of those, the ones which would have blocked
+
+   IoCount() : calls(0), again(0) {}
+};
+
 //! Writes an entire std::string to the file descriptor
 size_t write_n( int fd, const std::string& );
 
@@ -18,4 +28,12 @@ size_t read_n( int fd, std::string& s );
 
 //! Reads an entire binary buffer into a character array.
 size_t read_n( int fd, char** buf, size_t allochint=1024 );
+
+//! Reads up to a byte budget into a chain of pooled segments with readv.
+size_t read_chain( int fd, ntee::BufferPtr& head, size_t budget,
+                   IoCount* io = 0 );
+
+//! Writes an entire segment chain with writev, less skip leading bytes.
+size_t write_chain( int fd, const ntee::Buffer& head, size_t skip = 0,
+                    IoCount* io = 0 );
 #endif
@@ -38,13 +38,29 @@
 #include "Builder.hpp"
 #include "FileRecorder.hpp"
 #include "BinaryDataRecorder.hpp"
+#include "AsyncRecorder.hpp"
+#include "Error.hpp"
+
+//! Puts a Recorder on a thread of its own, as configured by the Settings.
+static boost::shared_ptr<ntee::Recorder> async( ntee::Recorder* r, 
+                                                const ntee::Settings& s )
+{
+   using namespace ntee;
+   boost::shared_ptr<Recorder> target( r );
+   return boost::shared_ptr<Recorder>( new AsyncRecorder( target, s.rec_queue,
+                                                          s.rec_policy ));
+}
 
 int main(int argc, char** argv)
 {
    //! The @NTEEPORT string when seen in the arguments will be expanded to whatever
    //! port the kernel selected for the ntee server.
    std::string USAGE("Usage: ntee [-h|--help] [-o <path>] [--sock <tcp|udp>] [-p <N>] [-H <host>]\n"
-                     "             --binary-only --hex-only\n"
+                     "             --binary-only --hex-only --multi --splice [--engine <epoll|uring>]\n"
+                     "             [--read-budget <bytes>]\n"
+                     "             [--queue-high <bytes>] [--queue-low <bytes>]\n"
+                     "             [--rec-queue <N>] [--rec-policy <block|drop-newest|drop-oldest>]\n"
+                     "             [--metrics <path>] [--segment-size <bytes>] [--segment-time <secs>]\n"
                      "             -L <host> <port> -R <cmd> [@NTEEPORT] [args...]\n");
    std::string HELP( "Purpose: NTEE is a program which sits between two other programs communicating\n"
                      "         through sockets.  As traffic comes between programs L and R, ntee\n"
@@ -61,7 +77,9 @@ int main(int argc, char** argv)
                      "  -o <path>         Path to where the output should be written.\n" 
                      "                     Defaults to ./ntee_output\n"
                      "  --sock <tcp|udp>  Defines the socket type which the L and R side processes\n"
-                     "                     are using.  Defaults to tcp.\n"
+                     "                     are using.  Defaults to tcp.  With udp each datagram is\n"
+                     "                     recorded on its own, and a single session lasts until\n"
+                     "                     the R program exits.\n"
                      "  -p <int>          Forces the port number upon which ntee will serve to the\n"
                      "                     R side process.  This is here in case the R program has\n"
                      "                     its connection hardcoded to use a certain port.\n"
@@ -72,6 +90,43 @@ int main(int argc, char** argv)
                      "                     with a .bdr extension.\n"
                      "  --hex-only        Only write a hex dump recording of the transmissions between\n"
                      "                     L and R side.\n"
+                     "  --multi           Multi-session proxy mode.  The ntee service stays open and\n"
+                     "                     every R side client which connects is paired with its own\n"
+                     "                     new connection to the L side.  All of the sessions are\n"
+                     "                     recorded into the same output files.  -R is optional in\n"
+                     "                     this mode, ntee runs until interrupted.\n"
+                     "  --splice          Zero copy relay.  Data is moved between L and R inside the\n"
+                     "                     kernel with splice(), and a tee() of it feeds the recorders.\n"
+                     "                     Recordings are cut at the pipe size (256K) or less.\n"
+                     "  --engine <epoll|uring>  Drives the TCP sessions with epoll readiness events, or\n"
+                     "                     submits their reads and writes to io_uring in batches.\n"
+                     "                     Falls back to epoll if io_uring isn't available.\n"
+                     "                     Defaults to epoll.\n"
+                     "  --read-budget <n> Most bytes read from a socket in one go, which is also the\n"
+                     "                     biggest message recorded.  Defaults to 1048576.\n"
+                     "  --queue-high <n>  Bytes waiting on a slow receiver at which ntee stops reading\n"
+                     "                     from the sender.  Defaults to 4194304.\n"
+                     "  --queue-low <n>   Bytes waiting at which reading from the sender resumes.\n"
+                     "                     Defaults to 1048576.\n"
+                     "  --rec-queue <N>   Each recorder writes from a thread of its own, and may fall\n"
+                     "                     up to N records behind the traffic.  Defaults to 4096.\n"
+                     "  --rec-policy <p>  What to do when a recorder is N records behind.  'block'\n"
+                     "                     (the default) holds up the traffic until there is room,\n"
+                     "                     'drop-newest' skips recording the new message, and\n"
+                     "                     'drop-oldest' skips the oldest waiting one.  The number\n"
+                     "                     of records dropped is reported at exit.\n"
+                     "  --metrics <path>  Serves live counters per session and direction, and of the\n"
+                     "                     recorders, in Prometheus text format on a Unix-domain\n"
+                     "                     socket at path.  Send any line or an HTTP GET to it,\n"
+                     "                     e.g. curl --unix-socket <path> http://ntee/metrics\n"
+                     "  --segment-size <n>  Splits the recordings into segment files of about n\n"
+                     "                     bytes each, named after the output with a number added,\n"
+                     "                     e.g. ntee_output.bdr.000000.  The output file itself\n"
+                     "                     becomes a manifest listing them in order, which\n"
+                     "                     ntee_player reads as one recording.  Each segment is\n"
+                     "                     preallocated.\n"
+                     "  --segment-time <secs>  Starts a new segment file every secs seconds.  May be\n"
+                     "                     given with --segment-size, whichever comes first.\n"
                      "  -L <ip> <int>     The ip address and port number of the L side process.\n"
                      "                     ntee will connect to this process after the R side program\n"
                      "                     has been started and decides to connect with ntees service\n"
@@ -90,8 +145,11 @@ int main(int argc, char** argv)
                      "                           settings for ntee.\n"
                      "\n"
                      "Notes:\n"
-                     "  - Both the -L and -R arguments must be specified for ntee to start properly.\n"
+                     "  - Both the -L and -R arguments must be specified for ntee to start properly,\n"
+                     "    unless --multi is given in which case only -L is required.\n"
                      "  - The -R option must be the final option passed to ntee!\n"
+                     "  - At exit, or when sent SIGUSR1, ntee prints to stderr how much it relayed\n"
+                     "    each way and the percentiles of the delay it added to the messages.\n"
                      "\n"
                );  /* end of HELP */
                    
@@ -105,15 +163,16 @@ int main(int argc, char** argv)
    
    if ( s.hex_only == false ) {
       //** make the Hex recording
-      pNT->addRecorder( boost::shared_ptr<Recorder>(new FileRecorder(s) ));
+      pNT->addRecorder( async( new FileRecorder(s), s ));
    }
    
    if ( s.binary_only == false ) {
       //** Binary data file uses the same name as FileRecorder, but with a .bdr extension.
       std::string sBDRfn = s.output_filename + ".bdr";
       BinaryDataRecorder* pBDR = new BinaryDataRecorder();
-      pBDR->open( sBDRfn.c_str() ); 
-      pNT->addRecorder( boost::shared_ptr<Recorder>(pBDR));
+      SysErrIf( pBDR->open( sBDRfn, s.segment_bytes, s.segment_secs ) == -1 )
+         .info("BinaryDataRecorder unable to open: %s\n", sBDRfn.c_str());
+      pNT->addRecorder( async( pBDR, s ));
    }
    
    return pNT->start();
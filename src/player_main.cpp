@@ -3,6 +3,9 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <signal.h>
 
 //! @brief  Player
 //!
@@ -11,7 +14,10 @@
 int main(int argc, char** argv) 
 {
    std::string USAGE(
-     "Usage: ntee_player [-h] <--client|--server> <host> <port> <datafile>\n");
+     "Usage: ntee_player [-h] <--client|--server> [--from-record <n>|--from-time <secs>]\n"
+     "                   [--window <n>] [--speed <x>|--blast|--rate <n>|\n"
+     "                    --connections <n> [--threads <n>]]\n"
+     "                   <host> <port> <datafile>\n");
    std::string HELP(
      "Purpose: Acts as either a client or server program and plays back\n"
      "         canned data from the input data file.\n"
@@ -25,6 +31,39 @@ int main(int argc, char** argv)
      "                listening on <host> and <port> and once a connection\n"
      "                is made, playing back server messages from the input\n"
      "                data file.\n"
+     "  --from-record <n>\n"
+     "               Starts the playback at record n of the file, counting\n"
+     "                from 0.\n"
+     "  --from-time <secs>\n"
+     "               Starts the playback at the first record read secs or\n"
+     "                more after the first record of the file.\n"
+     "  --window <n> Lets this side send while up to n of the other side's\n"
+     "                messages are still to come, 0 by default.  What\n"
+     "                comes is checked byte for byte against the\n"
+     "                recording, however the network has split it up.\n"
+     "  --speed <x>  Sends each message at the time it was recorded, counted\n"
+     "                from the start of the playback, with the pace scaled\n"
+     "                by x, from 0.1 to 100.  Waits on the other side are\n"
+     "                not held against the schedule.  How late the sends\n"
+     "                were is reported at the end.  Without it messages are\n"
+     "                sent back to back.\n"
+     "  --blast      Sends this side's messages as fast as the socket takes\n"
+     "                them, without waiting for the other side's.  Those\n"
+     "                are read at the same time, and only their total\n"
+     "                bytes are checked.  The rate is reported at the end.\n"
+     "  --rate <n>   Sends this side's messages at n a second, open loop,\n"
+     "                whether the other side has answered yet or not.\n"
+     "                Each answer is timed from when its message was due\n"
+     "                to be sent, so that a stalled server shows in the\n"
+     "                latency reported at the end.\n"
+     "  --connections <n>\n"
+     "               Plays the file over n connections at once, each one in\n"
+     "                step with the other side as usual.  A server waits\n"
+     "                for n clients.  The throughput and the time taken for\n"
+     "                the other side to answer are reported for each group\n"
+     "                of connections sharing a thread, and in total.\n"
+     "  --threads <n> Number of threads to share the connections between,\n"
+     "                by default one a core.\n"
      "  <host>       Symbolic or IP address to start socket on\n"
      "  <port>       Integer number of port to utilize when running\n"
      "  <datafile>   NTee output file which defines the message data to\n"
@@ -32,9 +71,10 @@ int main(int argc, char** argv)
      "\n"
      "NOTE:\n"
      "  Argument ordering is important and should exactly follow the usage\n"
-     "  statement (ie. --client or --server must be first followed by <host>,\n"
-     "  <port>, and <datafile> arguments.  The help option must be the first\n"
-     "  option supplied.\n" );
+     "  statement (ie. --client or --server must be first followed by any\n"
+     "  --from, --window, --speed, --blast, --rate, --connections or\n"
+     "  --threads options, then <host>, <port>, and <datafile> arguments.\n"
+     "  The help option must be the first option supplied.\n" );
    
    // handle case where we have no arguments given
    ErrIf( argc < 2 ).info(USAGE);
@@ -42,6 +82,14 @@ int main(int argc, char** argv)
    // At least one argument is present. Is it -h, --client, --server 
    // or is it something else?
    Player::Config pc;
+   pc.fromRecord = 0;
+   pc.fromTime = 0;
+   pc.speed = 0;
+   pc.blast = false;
+   pc.connections = 1;
+   pc.threads = 0;
+   pc.rate = 0;
+   pc.window = 0;
    if ( ! strcmp(argv[1],"-h") || ! strcmp(argv[1],"--help") ) {
       std::cerr << USAGE << HELP;
       return(0);
@@ -54,18 +102,76 @@ int main(int argc, char** argv)
       ErrIf( argv[1] ).info("First arg must be either -h, --client, or --server...\n%s\n",
                             USAGE.c_str());
 
+   // Then the options, ahead of the host, port and file
+   int a = 2;
+   while( a < argc && strncmp(argv[a],"--",2) == 0 ) {
+      char* end;
+      if ( strcmp(argv[a],"--blast") == 0 ) {
+         pc.blast = true;
+         ++a;
+         continue;
+      }
+      ErrIf( a+1 >= argc ).info("%s needs a value\n%s\n", argv[a], USAGE.c_str());
+      if ( strcmp(argv[a],"--from-record") == 0 ) {
+         pc.fromRecord = strtoull( argv[a+1], &end, 10 );
+         ErrIf( *end || ! isdigit(argv[a+1][0]) )
+            .info("Bad record number: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else if ( strcmp(argv[a],"--from-time") == 0 ) {
+         pc.fromTime = strtod( argv[a+1], &end );
+         ErrIf( *end || pc.fromTime < 0 )
+            .info("Bad time: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else if ( strcmp(argv[a],"--speed") == 0 ) {
+         pc.speed = strtod( argv[a+1], &end );
+         ErrIf( *end || pc.speed < 0.1 || pc.speed > 100 )
+            .info("Speed must be from 0.1 to 100: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else if ( strcmp(argv[a],"--rate") == 0 ) {
+         pc.rate = strtod( argv[a+1], &end );
+         ErrIf( *end || pc.rate <= 0 )
+            .info("Bad rate: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else if ( strcmp(argv[a],"--window") == 0 ) {
+         pc.window = strtoul( argv[a+1], &end, 10 );
+         ErrIf( *end || ! isdigit(argv[a+1][0]) )
+            .info("Bad window: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else if ( strcmp(argv[a],"--connections") == 0 ) {
+         pc.connections = strtoul( argv[a+1], &end, 10 );
+         ErrIf( *end || ! isdigit(argv[a+1][0]) || pc.connections < 1 )
+            .info("Bad number of connections: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else if ( strcmp(argv[a],"--threads") == 0 ) {
+         pc.threads = strtoul( argv[a+1], &end, 10 );
+         ErrIf( *end || ! isdigit(argv[a+1][0]) || pc.threads < 1 )
+            .info("Bad number of threads: %s\n%s\n", argv[a+1], USAGE.c_str());
+      }
+      else
+         ErrIf( true ).info("Bad option: %s\n%s\n", argv[a], USAGE.c_str());
+      a += 2;
+   }
+   ErrIf( (pc.blast ? 1 : 0) + (pc.speed > 0 ? 1 : 0) + (pc.rate > 0 ? 1 : 0)
+          + (pc.connections > 1 ? 1 : 0) > 1 )
+      .info("Only one of --speed, --blast, --rate and --connections can be "
+            "used\n%s\n", USAGE.c_str());
+
    // handle case where too few options are provided
-   ErrIf( argc < 5 ).info("Too few arguments...\n%s\n",USAGE.c_str());
+   ErrIf( argc < a+3 ).info("Too few arguments...\n%s\n",USAGE.c_str());
 
 
    // Grab the other args    
-   pc.host = argv[2];
-   pc.port = argv[3];
-   pc.file = argv[4];
+   pc.host = argv[a];
+   pc.port = argv[a+1];
+   pc.file = argv[a+2];
 
    // Create and configure the player
    Player p( pc );
    
+   // The other side going away must fail the send and show in the exit
+   // status, not kill the player
+   signal( SIGPIPE, SIG_IGN );
+   
    // Cause connection 
    return p.start();   
 }
@@ -1,19 +1,35 @@
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 #include <algorithm>
 #include <iterator>
+#include <deque>
 #include <string>
+#include <vector>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 #include "Error.hpp"
 #include "TCPSocket.hpp"
 #include "IPAddress.hpp"
+#include "EventLoop.hpp"
+#include "Histogram.hpp"
 using ntee::Socket;
 using ntee::TCPSocket;
+using ntee::EventLoop;
+using ntee::Histogram;
 
 static int send( int sock, int nb )
 {
@@ -36,6 +52,375 @@ static int recv( int sock )
 }
 
 
+//! @returns CLOCK_MONOTONIC in nsec.
+static uint64_t nowNsec()
+{
+   timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//! @brief What the load generator sends, and how.
+struct Workload {
+   int conns;           //!< connections, all to the same server
+   size_t minSize;      //!< smallest message
+   size_t maxSize;      //!< biggest message, sizes are spread evenly between
+   double meanSize;     //!< if > 0, sizes are spread exponentially instead
+   int depth;           //!< messages in flight on each connection
+   double seconds;      //!< how long to run for
+   bool echo;           //!< the server echoes, rather than counts, the bytes
+   unsigned int seed;   //!< of the message sizes, the same for each server
+
+   Workload() : conns(1), minSize(1024), maxSize(1024), meanSize(0),
+                depth(1), seconds(10), echo(false), seed(1)
+   {  /* empty */ }
+
+   //! @returns the size of the next message.
+   size_t nextSize( unsigned short xsubi[3] ) const
+   {
+      if ( meanSize > 0 ) {
+         double n = -meanSize * log( 1.0 - erand48( xsubi ) );
+         return std::max( (size_t) n, (size_t) 1 );
+      }
+      return minSize + (size_t) (erand48( xsubi ) * (maxSize - minSize + 1));
+   }
+};
+
+
+//! @brief What one run of the workload measured.
+struct Result {
+   uint64_t msgs;        //!< messages answered in full
+   uint64_t bytes;       //!< bytes of the messages answered
+   double secs;          //!< how long the run lasted
+   Histogram latency;    //!< nsec from a message's start to its answer
+
+   Result() : msgs(0), bytes(0), secs(0) {}
+};
+
+
+//! @brief One connection of the load generator.
+//!
+//! Keeps up to Workload::depth messages in flight.  Each message is timed
+//! from when it is started to when the server has answered all of its
+//! bytes, either by echoing them or by counting them back the way testSrv
+//! does: a 4 byte count in network order, padded out to 8 bytes.  The
+//! server may answer for any number of bytes at once, it is only the
+//! running total which is matched against the ends of the messages.
+class LoadConn {
+public:
+   LoadConn( const Workload& w, Result& r, const std::vector<char>& payload );
+   ~LoadConn();
+
+   int open( IPAddress& ip, EventLoop& loop );
+
+   //! No more messages are started, those in flight are abandoned.
+   void stop() { stopping_ = true; }
+
+private:
+   LoadConn( const LoadConn& );
+   LoadConn& operator=( const LoadConn& );
+
+   void onEvent( uint32_t events );
+   bool fill();
+   bool drain();
+   void close();
+
+   //! A message in flight: where its last byte is, and when it started.
+   typedef std::pair<uint64_t, uint64_t> Pending_t;
+
+   const Workload& w_;
+   Result& r_;
+   const std::vector<char>& payload_;   //!< what the messages are cut from
+   TCPSocket sock_;
+   EventLoop* loop_;
+   unsigned short xsubi_[3];            //!< message size sequence
+   std::deque<Pending_t> inflight_;     //!< oldest first
+   uint64_t started_;                   //!< bytes of all messages started
+   uint64_t sent_;                      //!< bytes written
+   uint64_t acked_;                     //!< bytes the server has answered
+   uint64_t done_;                      //!< end of the last message answered
+   char count_[8];                      //!< a count read in part
+   size_t countLen_;                    //!< bytes of count_ read so far
+   bool stopping_;
+   bool open_;
+};
+
+
+LoadConn::LoadConn( const Workload& w, Result& r, 
+                    const std::vector<char>& payload )
+ : w_(w), r_(r), payload_(payload), sock_("Load"), loop_(0),
+   started_(0), sent_(0), acked_(0), done_(0), countLen_(0), 
+   stopping_(false), open_(false)
+{
+   xsubi_[0] = 0x330e;
+   xsubi_[1] = w.seed & 0xffff;
+   xsubi_[2] = w.seed >> 16;
+}
+
+
+LoadConn::~LoadConn()
+{
+   close();
+}
+
+
+//! @brief Connects to the server and starts sending.
+//! @returns 0, or -1 with errno set if the connection failed.
+int LoadConn::open( IPAddress& ip, EventLoop& loop )
+{
+   if ( sock_.connectTo( ip ) == -1 )
+      return -1;
+   int on = 1;
+   setsockopt( sock_.getFD(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+   fcntl( sock_.getFD(), F_SETFL, O_NONBLOCK );
+   if ( loop.add( sock_.getFD(), EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                  boost::bind(&LoadConn::onEvent, this, _1) ) == -1 )
+      return -1;
+   loop_ = &loop;
+   open_ = true;
+   return 0;
+}
+
+
+//! Reads the answers, then starts and writes more messages.
+void LoadConn::onEvent( uint32_t events )
+{
+   if ( ! drain() || ! fill() )
+      close();
+}
+
+
+//! @brief Tops up the messages in flight and writes them out.
+//! @returns false if the connection failed.
+bool LoadConn::fill()
+{
+   while( ! stopping_ && inflight_.size() < (size_t) w_.depth ) {
+      started_ += w_.nextSize( xsubi_ );
+      inflight_.push_back( Pending_t( started_, nowNsec() ) );
+   }
+   while( sent_ < started_ ) {
+      size_t want = std::min( started_ - sent_, (uint64_t) payload_.size() );
+      ssize_t n = ::write( sock_.getFD(), &payload_[0], want );
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         return errno == EAGAIN;
+      }
+      sent_ += n;
+   }
+   return true;
+}
+
+
+//! @brief Reads the answers and retires the messages answered in full.
+//! @returns false once the server has closed, or the connection failed.
+bool LoadConn::drain()
+{
+   char buf[65536];
+   for( ;; ) {
+      ssize_t n = ::read( sock_.getFD(), buf, sizeof(buf) );
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         return errno == EAGAIN;
+      }
+      if ( n == 0 )
+         return false;
+
+      if ( w_.echo )
+         acked_ += n;
+      else {
+         for( ssize_t i=0; i < n; ++i ) {
+            count_[countLen_++] = buf[i];
+            if ( countLen_ == sizeof(count_) ) {
+               uint32_t c;
+               memcpy( &c, count_, sizeof(c) );
+               acked_ += ntohl( c );
+               countLen_ = 0;
+            }
+         }
+      }
+
+      uint64_t now = nowNsec();
+      while( ! inflight_.empty() && inflight_.front().first <= acked_ ) {
+         r_.latency.record( now - inflight_.front().second );
+         r_.bytes += inflight_.front().first - done_;
+         ++r_.msgs;
+         done_ = inflight_.front().first;
+         inflight_.pop_front();
+      }
+   }
+}
+
+
+void LoadConn::close()
+{
+   if ( ! open_ )
+      return;
+   if ( loop_ )
+      loop_->remove( sock_.getFD() );
+   sock_.close();
+   open_ = false;
+}
+
+
+//! @brief Runs the workload against one server.
+//!
+//! @param w      The workload.
+//! @param host   Server address.
+//! @param port   Server port.
+//! @returns what was measured.
+static Result runLoad( const Workload& w, const char* host, in_port_t port )
+{
+   std::vector<char> payload( std::min( w.meanSize > 0 ? 65536 : w.maxSize,
+                                        (size_t) 65536 ), 'X' );
+   Result r;
+   EventLoop loop;
+   IPAddress ip( host, port );
+   std::vector<boost::shared_ptr<LoadConn> > conns;
+   for( int i=0; i < w.conns; ++i ) {
+      conns.push_back( boost::shared_ptr<LoadConn>( 
+                          new LoadConn( w, r, payload ) ) );
+      SysErrIf( conns.back()->open( ip, loop ) == -1 )
+         .info("Unable to connect to %s:%d\n", host, port);
+   }
+
+   // Stop when the time is up.
+   int tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+   SysErrIf( tfd == -1 );
+   itimerspec its;
+   memset( &its, 0, sizeof(its) );
+   its.it_value.tv_sec = (time_t) w.seconds;
+   its.it_value.tv_nsec = (long) ((w.seconds - its.it_value.tv_sec) * 1e9);
+   SysErrIf( timerfd_settime( tfd, 0, &its, 0 ) == -1 );
+   SysErrIf( loop.add( tfd, EPOLLIN, 
+                       boost::bind(&EventLoop::stop, &loop) ) == -1 );
+
+   uint64_t start = nowNsec();
+   loop.run();
+   r.secs = (nowNsec() - start) / 1e9;
+
+   loop.remove( tfd );
+   ::close( tfd );
+   for( size_t i=0; i < conns.size(); ++i )
+      conns[i]->stop();
+   return r;
+}
+
+
+//! Prints one line of results.
+static void printResult( const char* host, in_port_t port, const Result& r )
+{
+   const Histogram& h = r.latency;
+   printf( "%s:%d  %llu msgs in %.2fs  %.0f msg/s  %.2f MB/s  "
+           "latency usec p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+           host, port, (unsigned long long) r.msgs, r.secs, r.msgs / r.secs,
+           r.bytes / r.secs / 1e6, h.percentile(50) / 1e3, 
+           h.percentile(90) / 1e3, h.percentile(99) / 1e3,
+           h.percentile(99.9) / 1e3, h.max() / 1e3 );
+}
+
+
+//! @brief Load generator main.
+//!
+//! Runs the workload against each server given, one after the other.
+//! With two servers, typically testSrv itself and ntee in front of it,
+//! the difference of the second to the first is printed as well, which
+//! is what ntee costs.
+//!
+//! @param argc  Arguments left after --load.
+//! @param argv  The arguments.
+static int loadMain( int argc, char** argv )
+{
+   std::string USAGE("Usage: testCli --load [-c <conns>] [-d <depth>] [-t <secs>]\n"
+                     "               [-s <bytes|min-max|exp:mean>] [--echo] [--seed <N>]\n"
+                     "               <server ip addr> <server port> [<ip addr> <port>]\n");
+   Workload w;
+   std::vector<std::pair<const char*, in_port_t> > servers;
+   for( int i=0; i < argc; ++i ) {
+      if ( ! strcmp(argv[i],"-c") && i+1 < argc ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    w.conns=boost::lexical_cast<int>(argv[++i]))
+                  .info("Bad connection count\n");
+      }
+      else if ( ! strcmp(argv[i],"-d") && i+1 < argc ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    w.depth=boost::lexical_cast<int>(argv[++i]))
+                  .info("Bad pipeline depth\n");
+      }
+      else if ( ! strcmp(argv[i],"-t") && i+1 < argc ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    w.seconds=boost::lexical_cast<double>(argv[++i]))
+                  .info("Bad duration\n");
+      }
+      else if ( ! strcmp(argv[i],"--seed") && i+1 < argc ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    w.seed=boost::lexical_cast<unsigned int>(argv[++i]))
+                  .info("Bad seed\n");
+      }
+      else if ( ! strcmp(argv[i],"-s") && i+1 < argc ) {
+         std::string sz( argv[++i] );
+         size_t dash = sz.find('-');
+         if ( sz.compare( 0, 4, "exp:" ) == 0 ) {
+            ErrIfCatch(boost::bad_lexical_cast,
+                       w.meanSize=boost::lexical_cast<double>(sz.substr(4)))
+                     .info("Bad mean message size\n");
+         }
+         else if ( dash != std::string::npos ) {
+            ErrIfCatch(boost::bad_lexical_cast,
+                       (w.minSize=boost::lexical_cast<size_t>(sz.substr(0,dash)),
+                        w.maxSize=boost::lexical_cast<size_t>(sz.substr(dash+1))))
+                     .info("Bad message size range\n");
+         }
+         else {
+            ErrIfCatch(boost::bad_lexical_cast,
+                       w.minSize=w.maxSize=boost::lexical_cast<size_t>(sz))
+                     .info("Bad message size\n");
+         }
+      }
+      else if ( ! strcmp(argv[i],"--echo") ) {
+         w.echo = true;
+      }
+      else if ( argv[i][0] != '-' && i+1 < argc ) {
+         in_port_t port;
+         ErrIfCatch(boost::bad_lexical_cast,
+                    port = boost::lexical_cast<in_port_t>( argv[i+1] ))
+                   .info("%s is not a port number!\n",argv[i+1]);
+         servers.push_back( std::make_pair( argv[i], port ) );
+         ++i;
+      }
+      else
+         ErrIf( true ).info(USAGE);
+   }
+   ErrIf( servers.empty() || servers.size() > 2 ).info(USAGE);
+   ErrIf( w.conns < 1 || w.depth < 1 || w.seconds <= 0 ).info(USAGE);
+   ErrIf( w.meanSize <= 0 && (w.minSize < 1 || w.maxSize < w.minSize) )
+      .info("Bad message size\n");
+
+   std::vector<Result> results;
+   for( size_t i=0; i < servers.size(); ++i ) {
+      results.push_back( runLoad( w, servers[i].first, servers[i].second ) );
+      printResult( servers[i].first, servers[i].second, results.back() );
+   }
+   if ( results.size() == 2 ) {
+      const Result& a = results[0];
+      const Result& b = results[1];
+      double rate = ( a.msgs > 0 ) ? 100.0 * ( b.msgs / b.secs ) 
+                                     / ( a.msgs / a.secs ) - 100 : 0;
+      printf( "delta  %+.1f%% msg/s  latency usec p50 %+.1f p99 %+.1f "
+              "p99.9 %+.1f\n", rate,
+              ( (double) b.latency.percentile(50) 
+                - a.latency.percentile(50) ) / 1e3,
+              ( (double) b.latency.percentile(99) 
+                - a.latency.percentile(99) ) / 1e3,
+              ( (double) b.latency.percentile(99.9) 
+                - a.latency.percentile(99.9) ) / 1e3 );
+   }
+   return 0;
+}
+
+
 //! This is a simple client to test the ntee program.
 //! The client simply sends messages of 10 bytes, and after each send
 //!  blocks to recieve a message from the server, which is the number
@@ -43,14 +428,21 @@ static int recv( int sock )
 //!  the number sent, the message is re-sent until the checks are valid
 //!  coming back from the server.
 //!
+//! Given --load first, it is a load generator instead, see loadMain().
+//!
 int main(int argc, char** argv)
 {
+   if ( argc > 1 && ! strcmp(argv[1],"--load") )
+      return loadMain( argc-2, &argv[2] );
+   
+
    // echo the command line
    std::cout << "testCli started command:\n\t";
    std::copy(argv, &argv[argc], std::ostream_iterator<char*>(std::cout, " "));
    std::cout << "\n";
    
-   std::string USAGE("Usage: testCli <server ip addr> <server port> [N pings=10]\n");
+   std::string USAGE("Usage: testCli <server ip addr> <server port> [N pings=10]\n"
+                     "       testCli --load [options] <server ip addr> <server port> ...\n");
    ErrIf( argc < 3 ).info(USAGE);
 
    //** Get the server address, port and maxPings arguments
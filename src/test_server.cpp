@@ -1,79 +1,449 @@
 #include <iostream>
 #include <cstdlib>
+#include <deque>
+#include <map>
 #include <string>
+#include <vector>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 #include "Error.hpp"
 #include "TCPSocket.hpp"
 #include "IPAddress.hpp"
-#include "Buffer.hpp"
+#include "EventLoop.hpp"
 using namespace ntee;
 
-static void handleClient(Socket&);
+//! Bytes waiting to be written to a client at which reading from it stops.
+static const size_t OUT_HIGH = 4*1024*1024;
 
-//! This is a simple server to test the ntee program.
-//! The server simply sends back to the client the number of bytes it
-//! just recieved from the client.
+
+//! @brief How the server answers what it reads.
+struct Options {
+   //! What is sent back for each read
+   enum Mode {
+      COUNT,            //!< the number of bytes read, as 8 bytes
+      ECHO,             //!< the bytes read
+      FIXED             //!< a fixed number of bytes
+   };
+
+   Mode mode;           //!< what the answer is
+   size_t fixed;        //!< answer size in FIXED mode
+   uint64_t delayNsec;  //!< service time added to every answer
+   bool verbose;        //!< print every read
+
+   Options() : mode(COUNT), fixed(0), delayNsec(0), verbose(false) {}
+};
+
+
+//! @returns CLOCK_MONOTONIC in nsec.
+static uint64_t nowNsec()
+{
+   timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//! @brief One client connection.
+//!
+//! Everything readable is read and answered as it comes in, the answers
+//! are written as far as the socket takes them and the rest on write
+//! readiness.  When a service delay is set the answers are held back
+//! on a timerfd until they are due.  A client which doesn't read its
+//! answers stops being read from once OUT_HIGH bytes are waiting.
+class Conn {
+public:
+   Conn( int fd, const Options& opts );
+   ~Conn();
+
+   int attach( EventLoop& loop, const boost::function<void ()>& closed );
+
+private:
+   Conn( const Conn& );
+   Conn& operator=( const Conn& );
+
+   void onEvent( uint32_t events );
+   void onTimer( uint32_t events );
+   bool serve();
+   bool readAll();
+   void answer( const char* buf, size_t len );
+   void release();
+   bool flush();
+   void arm();
+
+   //! An answer held back by the service delay, and when it is due.
+   typedef std::pair<uint64_t, std::string> Delayed_t;
+
+   int fd_;
+   int timer_;                     //!< timerfd for the delay, -1 if none
+   const Options& opts_;
+   EventLoop* loop_;
+   boost::function<void ()> closed_;   //!< tells the Worker we are done
+   std::string out_;               //!< answers waiting to be written
+   size_t sent_;                   //!< bytes of out_ already written
+   std::deque<Delayed_t> delayed_; //!< answers not due yet, oldest first
+   bool eof_;                      //!< the client has closed its side
+};
+
+
+Conn::Conn( int fd, const Options& opts )
+ : fd_(fd), timer_(-1), opts_(opts), loop_(0), sent_(0), eof_(false)
+{
+   fcntl( fd_, F_SETFL, O_NONBLOCK );
+}
+
+
+Conn::~Conn()
+{
+   if ( loop_ ) {
+      loop_->remove( fd_ );
+      if ( timer_ != -1 )
+         loop_->remove( timer_ );
+   }
+   if ( timer_ != -1 )
+      ::close( timer_ );
+   ::close( fd_ );
+}
+
+
+//! @brief Registers the connection, and its delay timer, with a loop.
+//!
+//! @param loop    The loop.
+//! @param closed  Called once the connection is done with; it may delete
+//!                the Conn.
+//! @returns 0, or -1 with errno set.
+int Conn::attach( EventLoop& loop, const boost::function<void ()>& closed )
+{
+   closed_ = closed;
+   // Set first, so that whatever was added is removed again if a later
+   // add fails and the Conn is let go of
+   loop_ = &loop;
+   if ( opts_.delayNsec > 0 ) {
+      timer_ = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC );
+      if ( timer_ == -1
+           || loop.add( timer_, EPOLLIN,
+                        boost::bind(&Conn::onTimer, this, _1) ) == -1 )
+         return -1;
+   }
+   if ( loop.add( fd_, EPOLLIN|EPOLLOUT|EPOLLRDHUP,
+                  boost::bind(&Conn::onEvent, this, _1) ) == -1 )
+      return -1;
+   return 0;
+}
+
+
+//! Reads and answers, and writes what is waiting.
+void Conn::onEvent( uint32_t events )
+{
+   if ( ! serve() ) {
+      closed_();
+      return;
+   }
+   if ( eof_ && out_.empty() && delayed_.empty() )
+      closed_();
+}
+
+
+//! Moves the answers which are due to the output.
+void Conn::onTimer( uint32_t events )
+{
+   uint64_t ticks;
+   while( ::read( timer_, &ticks, sizeof(ticks) ) > 0 ) {
+      /* empty the timer */
+   }
+   release();
+   if ( ! serve() ) {
+      closed_();
+      return;
+   }
+   if ( eof_ && out_.empty() && delayed_.empty() )
+      closed_();
+}
+
+
+//! @brief Reads and answers, and writes the answers out.
+//!
+//! If reading stopped because too much was waiting to be written, and
+//! writing then made room, reading picks up again: the data left unread
+//! announced itself on an edge long gone.
+//!
+//! @returns false if the connection failed.
+bool Conn::serve()
+{
+   for( ;; ) {
+      if ( ! readAll() )
+         return false;
+      bool full = out_.size() - sent_ >= OUT_HIGH;
+      if ( ! flush() )
+         return false;
+      if ( ! full || out_.size() - sent_ >= OUT_HIGH )
+         return true;
+   }
+}
+
+
+//! @brief Reads until the socket would block, answering each read.
+//!
+//! Stops early once OUT_HIGH bytes are waiting to be written.
+//!
+//! @returns false if the connection failed.
+bool Conn::readAll()
+{
+   char buf[65536];
+   while( ! eof_ && out_.size() - sent_ < OUT_HIGH ) {
+      ssize_t n = ::read( fd_, buf, sizeof(buf) );
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         return errno == EAGAIN;
+      }
+      if ( n == 0 ) {
+         eof_ = true;
+         break;
+      }
+      if ( opts_.verbose )
+         std::cout << "    RECIEVED " << n << " bytes\n";
+      answer( buf, n );
+   }
+   return true;
+}
+
+
+//! @brief Makes the answer to one read, and queues or holds it back.
+//! @param buf  What was read.
+//! @param len  Bytes read.
+void Conn::answer( const char* buf, size_t len )
+{
+   std::string a;
+   switch( opts_.mode ) {
+   case Options::ECHO:
+      a.assign( buf, len );
+      break;
+   case Options::FIXED:
+      a.assign( opts_.fixed, 'Y' );
+      break;
+   case Options::COUNT:
+   default: {
+      // 4 bytes in network order padded out to 8, as it always was.
+      uint32_t c = htonl( len );
+      a.assign( 8, '\0' );
+      memcpy( &a[0], &c, sizeof(c) );
+      break;
+   }
+   }
+
+   if ( opts_.delayNsec == 0 ) {
+      out_.append( a );
+      return;
+   }
+   delayed_.push_back( Delayed_t( nowNsec() + opts_.delayNsec, a ) );
+   if ( delayed_.size() == 1 )
+      arm();
+}
+
+
+//! Moves the held back answers which are due to the output.
+void Conn::release()
+{
+   uint64_t now = nowNsec();
+   while( ! delayed_.empty() && delayed_.front().first <= now ) {
+      out_.append( delayed_.front().second );
+      delayed_.pop_front();
+   }
+   if ( ! delayed_.empty() )
+      arm();
+}
+
+
+//! Sets the delay timer off when the oldest held back answer is due.
+void Conn::arm()
+{
+   uint64_t due = delayed_.front().first;
+   itimerspec its;
+   memset( &its, 0, sizeof(its) );
+   its.it_value.tv_sec = due / 1000000000ULL;
+   its.it_value.tv_nsec = due % 1000000000ULL;
+   timerfd_settime( timer_, TFD_TIMER_ABSTIME, &its, 0 );
+}
+
+
+//! @brief Writes the output as far as the socket takes it.
+//! @returns false if the connection failed.
+bool Conn::flush()
+{
+   while( sent_ < out_.size() ) {
+      ssize_t n = ::write( fd_, out_.data() + sent_, out_.size() - sent_ );
+      if ( n == -1 ) {
+         if ( errno == EINTR )
+            continue;
+         if ( errno == EAGAIN )
+            break;
+         return false;
+      }
+      sent_ += n;
+   }
+   if ( sent_ == out_.size() ) {
+      out_.clear();
+      sent_ = 0;
+   }
+   return true;
+}
+
+
+//! @brief One thread's share of the clients.
+//!
+//! Every Worker has an EventLoop of its own and watches the same non-
+//! blocking listening socket; whichever wins the accept() serves the
+//! client from then on.
+class Worker {
+public:
+   Worker( int listenFd, const Options& opts );
+
+   void run();
+
+private:
+   void acceptClients( uint32_t events );
+   void closed( int fd );
+
+   typedef std::map<int, boost::shared_ptr<Conn> > ConnMap_t;
+
+   int listenFd_;
+   const Options& opts_;
+   EventLoop loop_;
+   ConnMap_t conns_;
+};
+
+
+Worker::Worker( int listenFd, const Options& opts )
+ : listenFd_(listenFd), opts_(opts)
+{
+   SysErrIf( loop_.add( listenFd_, EPOLLIN,
+                        boost::bind(&Worker::acceptClients, this, _1) ) == -1 );
+}
+
+
+//! Serves clients until the process is killed.
+void Worker::run()
+{
+   loop_.run();
+}
+
+
+//! Accepts every waiting client.
+void Worker::acceptClients( uint32_t events )
+{
+   int fd;
+   while( (fd=::accept( listenFd_, 0, 0 )) != -1 ) {
+      boost::shared_ptr<Conn> c( new Conn( fd, opts_ ) );
+      if ( c->attach( loop_, boost::bind(&Worker::closed, this, fd) ) == -1 )
+         continue;
+      conns_[fd] = c;
+      if ( opts_.verbose )
+         std::cout << "Connection made: fd = " << fd << "\n";
+   }
+   SysErrIf( errno != EAGAIN && errno != ECONNABORTED && errno != EINTR );
+}
+
+
+//! Forgets a client which is done, which closes it.
+void Worker::closed( int fd )
+{
+   if ( opts_.verbose )
+      std::cout << "Client DISCONNECTED\n";
+   conns_.erase( fd );
+}
+
+
+//! This is a server to test and benchmark the ntee program with.
+//! By default the server sends back to the client the number of bytes it
+//! just recieved from the client.  It can echo instead, or send back a
+//! fixed number of bytes, and can hold every answer back by a service
+//! time.  Any number of clients are served at once, by one or more
+//! threads.
 //!
 int main(int argc, char** argv)
 {
-   std::string USAGE("Usage: testSrv <server port>\n");
-   ErrIf( argc < 2 ).info(USAGE);
+   std::string USAGE("Usage: testSrv [--mode <count|echo|fixed:N>] [--delay <usec>]\n"
+                     "               [-j <threads>] [-v] <server port>\n");
+   Options opts;
+   int threads = 1;
+   const char* portArg = 0;
+   for( int i=1; i < argc; ++i ) {
+      if ( ! strcmp(argv[i],"--mode") && i+1 < argc ) {
+         std::string m( argv[++i] );
+         if ( m == "count" )
+            opts.mode = Options::COUNT;
+         else if ( m == "echo" )
+            opts.mode = Options::ECHO;
+         else if ( m.compare( 0, 6, "fixed:" ) == 0 ) {
+            opts.mode = Options::FIXED;
+            ErrIfCatch(boost::bad_lexical_cast,
+                       opts.fixed=boost::lexical_cast<size_t>(m.substr(6)))
+                     .info("Bad fixed answer size\n");
+         }
+         else
+            ErrIf( true ).info("Bad mode: %s\n", m.c_str());
+      }
+      else if ( ! strcmp(argv[i],"--delay") && i+1 < argc ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    opts.delayNsec=boost::lexical_cast<uint64_t>(argv[++i])*1000)
+                  .info("Bad delay\n");
+      }
+      else if ( ! strcmp(argv[i],"-j") && i+1 < argc ) {
+         ErrIfCatch(boost::bad_lexical_cast,
+                    threads=boost::lexical_cast<int>(argv[++i]))
+                  .info("Bad thread count\n");
+      }
+      else if ( ! strcmp(argv[i],"-v") ) {
+         opts.verbose = true;
+      }
+      else if ( argv[i][0] != '-' && ! portArg ) {
+         portArg = argv[i];
+      }
+      else
+         ErrIf( true ).info(USAGE);
+   }
+   ErrIf( portArg == 0 || threads < 1 ).info(USAGE);
 
    // Convert the port number arg to an int
    in_port_t port;
    ErrIfCatch(boost::bad_lexical_cast,
-              port = boost::lexical_cast<in_port_t>( argv[1] ))
-             .info("%s is not a port number!\n",argv[1]);
-      
+              port = boost::lexical_cast<in_port_t>( portArg ))
+             .info("%s is not a port number!\n",portArg);
+
+   signal( SIGPIPE, SIG_IGN );
+
    //** Get the server to accept stage
    IPAddress ip("localhost", port);
    Socket* sock = new TCPSocket("Svc");
+   int on = 1;
+   setsockopt( sock->getFD(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
    sock->listenOn(ip);
+   SysErrIf( listen( sock->getFD(), SOMAXCONN ) == -1 );
+   fcntl( sock->getFD(), F_SETFL, O_NONBLOCK );
+
+   //** Serve on every thread, this one included, until killed
+   std::vector<boost::shared_ptr<Worker> > workers;
+   for( int i=0; i < threads; ++i )
+      workers.push_back( boost::shared_ptr<Worker>(
+                            new Worker( sock->getFD(), opts ) ) );
+   boost::thread_group pool;
+   for( int i=1; i < threads; ++i )
+      pool.create_thread( boost::bind(&Worker::run, workers[i].get()) );
+   workers[0]->run();
 
-   
-   //** Forever accept new connections and reply
-   for( ;; ) {
-     Socket* cliSock = sock->accept("Client");
-     std::cout << "Connection made: fd = " << cliSock->getFD() << "\n";     
-     handleClient( *cliSock );
-     delete cliSock;
-   }
-   
    delete sock;
    return 0;
 }
-
-
-//! Handles client communication details.
-//! The server will loop until the client closes the socket waiting to read
-//! up to 1024 bytes off the socket.
-//!
-//! @param cliSock   client socket
-//!
-void handleClient( Socket& cliSock ) {
-
-   Buffer* pB;
-   size_t total;
-
-   while( (pB=cliSock.recv()) != 0 ) {
-      total = pB->len;
-      delete pB;
-      
-      std::cout << "    RECIEVED " << total << " bytes\n"; 
-
-      size_t snb = htonl(total);
-      Buffer b(false);    // NOT dynamic memory.
-      b.buf = (const char*) &snb;
-      b.len = sizeof(snb);
-      WarnIf( (snb=cliSock.send(b)) < b.len );
-   }
-   std::cout << "Client DISCONNECTED\n"; 
-}